@@ -0,0 +1,406 @@
+#include "blockmap.h"
+#include "config.h"
+#include "item.h"
+#include "light.h"
+#include "map.h"
+#include "mesh.h"
+#include "tinycthread.h"
+#include "world.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Headless benchmark of the chunk mesher and the light engine.
+// It generates terrain with create_world() and clouds with compute_clouds(),
+// lights the terrain with the light engine and runs compute_chunk() on every
+// chunk that has all of its neighbors, first on one thread and then on
+// several threads. No window or OpenGL context is needed. The checksum of the
+// vertex data changes whenever the output of the mesher changes.
+//
+// Usage: craft_bench [-r radius] [-n rounds] [-t threads] [-l lights]
+//                    [-g generator]
+// - radius: chunks are generated in a square of 2 * radius + 1 chunks
+// - rounds: number of times that every chunk is meshed
+// - threads: number of threads for the multi-threaded run
+// - lights: number of light sources placed in each chunk
+// - generator: terrain generator (WORLD_GEN_*, default classic)
+
+
+// A chunk of the benchmark world
+typedef struct {
+    BlockMap map;           // block types
+    BlockMap light_levels;  // light levels
+    Map lights;             // light sources
+} BenchChunk;
+
+
+// Benchmark world: a square of chunks around chunk (0, 0)
+typedef struct {
+    int radius;
+    int size;
+    BenchChunk *chunks;
+    NoiseContext noise;     // the default world, like the client's
+} BenchWorld;
+
+
+// Shared state of the multi-threaded run
+typedef struct {
+    BenchWorld *world;
+    int *jobs;              // chunk indices to mesh
+    int job_count;
+    int next;               // next entry of jobs to take
+    mtx_t mtx;              // lock for next
+    long long faces;        // faces generated by all threads
+} BenchRun;
+
+
+static double now(void) {
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    clock_gettime(TIME_UTC, &ts);
+#endif
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static int floor_div(int a, int b) {
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+
+// Find the chunk that holds a block, or NULL if it is outside of the world
+static BenchChunk *find_bench_chunk(BenchWorld *world, int x, int z) {
+    int p = floor_div(x, CHUNK_SIZE) + world->radius;
+    int q = floor_div(z, CHUNK_SIZE) + world->radius;
+    if (p < 0 || q < 0 || p >= world->size || q >= world->size) {
+        return 0;
+    }
+    return world->chunks + p * world->size + q;
+}
+
+
+static void bench_set_block(int x, int y, int z, int w, void *arg) {
+    block_map_set((BlockMap *)arg, x, y, z, w);
+}
+
+
+static int bench_get_level(void *arg, int x, int y, int z) {
+    BenchChunk *chunk = find_bench_chunk((BenchWorld *)arg, x, z);
+    if (!chunk || y < 0 || y >= BLOCK_MAP_HEIGHT) {
+        return -1;
+    }
+    return block_map_get(&chunk->light_levels, x, y, z);
+}
+
+
+static void bench_set_level(void *arg, int x, int y, int z, int w) {
+    BenchChunk *chunk = find_bench_chunk((BenchWorld *)arg, x, z);
+    block_map_set(&chunk->light_levels, x, y, z, w);
+}
+
+
+static int bench_get_source(void *arg, int x, int y, int z) {
+    BenchChunk *chunk = find_bench_chunk((BenchWorld *)arg, x, z);
+    return chunk ? map_get(&chunk->lights, x, y, z) : 0;
+}
+
+
+static int bench_is_opaque(void *arg, int x, int y, int z) {
+    BenchChunk *chunk = find_bench_chunk((BenchWorld *)arg, x, z);
+    return !is_transparent(block_map_get(&chunk->map, x, y, z));
+}
+
+
+// Point a worker item at the maps of a chunk and the light levels of its
+// neighbors
+static void setup_item(BenchWorld *world, WorkerItem *item, int index) {
+    int a = index / world->size;
+    int b = index % world->size;
+    item->p = a - world->radius;
+    item->q = b - world->radius;
+    item->sections = CHUNK_DIRTY_ALL;
+    item->noise = &world->noise;
+    item->block_map = &world->chunks[index].map;
+    for (int dp = -1; dp <= 1; dp++) {
+        for (int dq = -1; dq <= 1; dq++) {
+            BenchChunk *other =
+                world->chunks + (a + dp) * world->size + (b + dq);
+            item->level_maps[dp + 1][dq + 1] = &other->light_levels;
+        }
+    }
+}
+
+
+// Count the faces and vertex bytes of the meshes generated for an item
+static int item_faces(const WorkerItem *item, long long *bytes) {
+    int faces = 0;
+    for (int i = 0; i < CHUNK_MESH_SECTIONS; i++) {
+        const WorkerMesh *mesh = item->meshes + i;
+        faces += mesh->faces + mesh->plant_faces;
+        *bytes += sizeof(ChunkVertex) * 4 * mesh->faces;
+        *bytes += sizeof(GLfloat) * 6 * 10 * mesh->plant_faces;
+    }
+    return faces;
+}
+
+
+// Add the vertex data of an item to a FNV-1a hash
+static unsigned int hash_item(unsigned int hash, const WorkerItem *item) {
+    for (int i = 0; i < CHUNK_MESH_SECTIONS; i++) {
+        const WorkerMesh *mesh = item->meshes + i;
+        const unsigned char *data = (const unsigned char *)mesh->data;
+        int size = sizeof(ChunkVertex) * 4 * mesh->faces;
+        for (int j = 0; j < 2; j++) {
+            for (int k = 0; k < size; k++) {
+                hash = (hash ^ data[k]) * 16777619u;
+            }
+            data = (const unsigned char *)mesh->plant_data;
+            size = sizeof(GLfloat) * 6 * 10 * mesh->plant_faces;
+        }
+    }
+    return hash;
+}
+
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+
+static double percentile(const double *sorted, int count, double p) {
+    int index = (int)(p * (count - 1) + 0.5);
+    return sorted[index];
+}
+
+
+static int bench_worker(void *arg) {
+    BenchRun *run = (BenchRun *)arg;
+    WorkerItem *item = calloc(1, sizeof(WorkerItem));
+    ChunkScratch scratch = {0};
+    long long bytes = 0;
+    long long faces = 0;
+    while (1) {
+        mtx_lock(&run->mtx);
+        int next = run->next++;
+        mtx_unlock(&run->mtx);
+        if (next >= run->job_count) {
+            break;
+        }
+        setup_item(run->world, item, run->jobs[next]);
+        compute_chunk(item, &scratch);
+        faces += item_faces(item, &bytes);
+    }
+    mtx_lock(&run->mtx);
+    run->faces += faces;
+    mtx_unlock(&run->mtx);
+    free(item->data);
+    free(item->plant_data);
+    free(item);
+    free_chunk_scratch(&scratch);
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+    int radius = 4;
+    int rounds = 5;
+    int threads = 4;
+    int lights = 2;
+    int generator = WORLD_GEN_CLASSIC;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        int value = atoi(argv[i + 1]);
+        if (!strcmp(argv[i], "-r")) {
+            radius = value;
+        }
+        else if (!strcmp(argv[i], "-n")) {
+            rounds = value;
+        }
+        else if (!strcmp(argv[i], "-t")) {
+            threads = value;
+        }
+        else if (!strcmp(argv[i], "-l")) {
+            lights = value;
+        }
+        else if (!strcmp(argv[i], "-g")) {
+            generator = value;
+        }
+    }
+    if (radius < 1 || rounds < 1 || threads < 1 || lights < 0 ||
+        generator < WORLD_GEN_CLASSIC || generator > WORLD_GEN_LATTICE)
+    {
+        fprintf(stderr,
+            "Usage: %s [-r radius] [-n rounds] [-t threads] [-l lights] "
+            "[-g generator]\n",
+            argv[0]);
+        return 1;
+    }
+
+    // generate the terrain
+    BenchWorld world;
+    world.radius = radius;
+    world.size = radius * 2 + 1;
+    int chunk_count = world.size * world.size;
+    world.chunks = calloc(chunk_count, sizeof(BenchChunk));
+    noise_init(&world.noise);
+    double start = now();
+    long long map_bytes = 0;
+    for (int i = 0; i < chunk_count; i++) {
+        BenchChunk *chunk = world.chunks + i;
+        int p = i / world.size - radius;
+        int q = i % world.size - radius;
+        int dx = p * CHUNK_SIZE - 1;
+        int dz = q * CHUNK_SIZE - 1;
+        block_map_alloc(&chunk->map, dx, 0, dz);
+        block_map_alloc(&chunk->light_levels, dx, 0, dz);
+        map_alloc(&chunk->lights, dx, 0, dz, 0xf);
+        create_world(
+            p, q, &world.noise, generator, bench_set_block, &chunk->map);
+        map_bytes += block_map_memory(&chunk->map);
+    }
+    double world_time = now() - start;
+    printf("world: %d chunks in %.1f ms (%.1f KiB of blocks)\n",
+        chunk_count, world_time * 1000, map_bytes / 1024.0);
+
+    // the cloud layer is made once per chunk, apart from the terrain
+    ChunkVertex *cloud_data = malloc(sizeof(ChunkVertex) * 4 * CLOUD_MAX_FACES);
+    long long cloud_faces = 0;
+    start = now();
+    for (int i = 0; i < chunk_count; i++) {
+        int p = i / world.size - radius;
+        int q = i % world.size - radius;
+        cloud_faces += compute_clouds(p, q, &world.noise, cloud_data);
+    }
+    double cloud_time = now() - start;
+    printf("clouds: %d chunks in %.1f ms (%lld faces)\n",
+        chunk_count, cloud_time * 1000, cloud_faces);
+    free(cloud_data);
+
+    // light the terrain with sources placed on the ground
+    LightWorld light_world;
+    light_world.arg = &world;
+    light_world.get_level = bench_get_level;
+    light_world.set_level = bench_set_level;
+    light_world.get_source = bench_get_source;
+    light_world.is_opaque = bench_is_opaque;
+    LightEngine engine;
+    light_engine_init(&engine, light_world);
+    srand(1);
+    start = now();
+    for (int i = 0; i < chunk_count; i++) {
+        BenchChunk *chunk = world.chunks + i;
+        int p = i / world.size - radius;
+        int q = i % world.size - radius;
+        for (int j = 0; j < lights; j++) {
+            int x = p * CHUNK_SIZE + rand() % CHUNK_SIZE;
+            int z = q * CHUNK_SIZE + rand() % CHUNK_SIZE;
+            int y = BLOCK_MAP_HEIGHT - 1;
+            while (y > 0 && !block_map_get(&chunk->map, x, y - 1, z)) {
+                y--;
+            }
+            map_set(&chunk->lights, x, y, z, 15);
+            light_add(&engine, x, y, z, 15);
+        }
+    }
+    light_update(&engine);
+    double light_time = now() - start;
+    long long lit = 0;
+    for (int i = 0; i < chunk_count; i++) {
+        lit += block_map_size(&world.chunks[i].light_levels);
+    }
+    printf("light: %d sources in %.1f ms (%lld lit blocks)\n",
+        chunk_count * lights, light_time * 1000, lit);
+    light_engine_free(&engine);
+
+    // mesh every chunk that has all of its neighbors
+    int job_count = 0;
+    int *jobs = malloc(sizeof(int) * chunk_count);
+    for (int a = 1; a < world.size - 1; a++) {
+        for (int b = 1; b < world.size - 1; b++) {
+            jobs[job_count++] = a * world.size + b;
+        }
+    }
+
+    // single-threaded
+    WorkerItem *item = calloc(1, sizeof(WorkerItem));
+    ChunkScratch scratch = {0};
+    double *times = malloc(sizeof(double) * job_count * rounds);
+    long long faces = 0;
+    long long bytes = 0;
+    unsigned int checksum = 2166136261u;
+    double total = 0;
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < job_count; i++) {
+            setup_item(&world, item, jobs[i]);
+            start = now();
+            compute_chunk(item, &scratch);
+            double elapsed = now() - start;
+            times[r * job_count + i] = elapsed;
+            total += elapsed;
+            faces += item_faces(item, &bytes);
+            if (r == 0) {
+                checksum = hash_item(checksum, item);
+            }
+        }
+    }
+    int meshed = job_count * rounds;
+    qsort(times, meshed, sizeof(double), compare_doubles);
+    printf("mesh (1 thread): %d chunks, %.1f chunks/s, %.0f faces/s\n",
+        meshed, meshed / total, faces / total);
+    printf("  per chunk: %.3f ms p50, %.3f ms p90, %.3f ms p99, %.3f ms max\n",
+        percentile(times, meshed, 0.5) * 1000,
+        percentile(times, meshed, 0.9) * 1000,
+        percentile(times, meshed, 0.99) * 1000,
+        times[meshed - 1] * 1000);
+    printf("  faces per chunk: %.1f, vertex bytes per chunk: %.1f KiB\n",
+        (double)faces / meshed, bytes / 1024.0 / meshed);
+    printf("  allocated: %.1f KiB scratch, %.1f KiB vertex buffers\n",
+        chunk_scratch_memory(&scratch) / 1024.0,
+        (sizeof(ChunkVertex) * 4 * item->capacity +
+         sizeof(GLfloat) * 6 * 10 * item->plant_capacity) / 1024.0);
+    printf("  checksum: %08x\n", checksum);
+    free(item->data);
+    free(item->plant_data);
+    free(item);
+    free_chunk_scratch(&scratch);
+    free(times);
+
+    // multi-threaded
+    BenchRun run;
+    run.world = &world;
+    run.job_count = job_count * rounds;
+    run.jobs = malloc(sizeof(int) * run.job_count);
+    for (int i = 0; i < run.job_count; i++) {
+        run.jobs[i] = jobs[i % job_count];
+    }
+    run.next = 0;
+    run.faces = 0;
+    mtx_init(&run.mtx, mtx_plain);
+    thrd_t *thrds = malloc(sizeof(thrd_t) * threads);
+    start = now();
+    for (int i = 0; i < threads; i++) {
+        thrd_create(thrds + i, bench_worker, &run);
+    }
+    for (int i = 0; i < threads; i++) {
+        thrd_join(thrds[i], NULL);
+    }
+    double elapsed = now() - start;
+    printf("mesh (%d threads): %d chunks, %.1f chunks/s, %.0f faces/s\n",
+        threads, run.job_count, run.job_count / elapsed, run.faces / elapsed);
+    mtx_destroy(&run.mtx);
+    free(thrds);
+    free(run.jobs);
+    free(jobs);
+
+    for (int i = 0; i < chunk_count; i++) {
+        BenchChunk *chunk = world.chunks + i;
+        block_map_free(&chunk->map);
+        block_map_free(&chunk->light_levels);
+        map_free(&chunk->lights);
+    }
+    free(world.chunks);
+    return 0;
+}
@@ -27,6 +27,13 @@ SOFTWARE.
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include "noise.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NOISE_SSE2
+#include <emmintrin.h>
+#endif
 
 #define F2 0.3660254037844386f
 #define G2 0.21132486540518713f
@@ -42,7 +49,8 @@ const static float GRAD3[16][3] = {
     { 1, 0,-1}, {-1, 0,-1}, { 0,-1, 1}, { 0, 1, 1}
 };
 
-static unsigned char PERM[] = {
+/* The permutation table of the default (unseeded) noise */
+static const unsigned char PERM[] = {
     151, 160, 137,  91,  90,  15, 131,  13,
     201,  95,  96,  53, 194, 233,   7, 225,
     140,  36, 103,  30,  69, 142,   8,  99,
@@ -109,24 +117,51 @@ static unsigned char PERM[] = {
     128, 195,  78,  66, 215,  61, 156, 180
 };
 
+/* The permutation table of seed(), simplex2() and simplex3() */
+static unsigned char SEEDED[512];
+static const unsigned char *GLOBAL_PERM = PERM;
+
 void seed(unsigned int x) {
     srand(x);
     for (int i = 0; i < 256; i++) {
-        PERM[i] = i;
+        SEEDED[i] = i;
     }
     for (int i = 255; i > 0; i--) {
         int j;
         int n = i + 1;
         while (n <= (j = rand() / (RAND_MAX / n)));
-        unsigned char a = PERM[i];
-        unsigned char b = PERM[j];
-        PERM[i] = b;
-        PERM[j] = a;
+        unsigned char a = SEEDED[i];
+        unsigned char b = SEEDED[j];
+        SEEDED[i] = b;
+        SEEDED[j] = a;
+    }
+    memcpy(SEEDED + 256, SEEDED, sizeof(unsigned char) * 256);
+    GLOBAL_PERM = SEEDED;
+}
+
+void noise_init(NoiseContext *context) {
+    memcpy(context->perm, PERM, sizeof(context->perm));
+}
+
+void noise_seed(NoiseContext *context, unsigned int x) {
+    /* shuffle with a private generator (not rand()) so that the table only
+       depends on the seed and seeding is thread-safe */
+    unsigned int state = x;
+    unsigned char *perm = context->perm;
+    for (int i = 0; i < 256; i++) {
+        perm[i] = i;
+    }
+    for (int i = 255; i > 0; i--) {
+        state = state * 1664525u + 1013904223u;
+        int j = (int)((state >> 16) % (unsigned int)(i + 1));
+        unsigned char a = perm[i];
+        perm[i] = perm[j];
+        perm[j] = a;
     }
-    memcpy(PERM + 256, PERM, sizeof(unsigned char) * 256);
+    memcpy(perm + 256, perm, sizeof(unsigned char) * 256);
 }
 
-float noise2(float x, float y) {
+static float noise2(const unsigned char *perm, float x, float y) {
     int i1, j1, I, J, c;
     float s = (x + y) * F2;
     float i = floorf(x + s);
@@ -150,9 +185,9 @@ float noise2(float x, float y) {
 
     I = (int) i & 255;
     J = (int) j & 255;
-    g[0] = PERM[I + PERM[J]] % 12;
-    g[1] = PERM[I + i1 + PERM[J + j1]] % 12;
-    g[2] = PERM[I + 1 + PERM[J + 1]] % 12;
+    g[0] = perm[I + perm[J]] % 12;
+    g[1] = perm[I + i1 + perm[J + j1]] % 12;
+    g[2] = perm[I + 1 + perm[J + 1]] % 12;
 
     for (c = 0; c <= 2; c++) {
         f[c] = 0.5f - xx[c]*xx[c] - yy[c]*yy[c];
@@ -168,7 +203,7 @@ float noise2(float x, float y) {
     return (noise[0] + noise[1] + noise[2]) * 70.0f;
 }
 
-float noise3(float x, float y, float z) {
+static float noise3(const unsigned char *perm, float x, float y, float z) {
     int c, o1[3], o2[3], g[4], I, J, K;
     float f[4], noise[4] = {0.0f, 0.0f, 0.0f, 0.0f};
     float s = (x + y + z) * F3;
@@ -216,10 +251,10 @@ float noise3(float x, float y, float z) {
     I = (int) i & 255; 
     J = (int) j & 255; 
     K = (int) k & 255;
-    g[0] = PERM[I + PERM[J + PERM[K]]] % 12;
-    g[1] = PERM[I + o1[0] + PERM[J + o1[1] + PERM[o1[2] + K]]] % 12;
-    g[2] = PERM[I + o2[0] + PERM[J + o2[1] + PERM[o2[2] + K]]] % 12;
-    g[3] = PERM[I + 1 + PERM[J + 1 + PERM[K + 1]]] % 12; 
+    g[0] = perm[I + perm[J + perm[K]]] % 12;
+    g[1] = perm[I + o1[0] + perm[J + o1[1] + perm[o1[2] + K]]] % 12;
+    g[2] = perm[I + o2[0] + perm[J + o2[1] + perm[o2[2] + K]]] % 12;
+    g[3] = perm[I + 1 + perm[J + 1 + perm[K + 1]]] % 12; 
 
     for (c = 0; c <= 3; c++) {
         f[c] = 0.6f - pos[c][0] * pos[c][0] - pos[c][1] * pos[c][1] -
@@ -235,38 +270,309 @@ float noise3(float x, float y, float z) {
     return (noise[0] + noise[1] + noise[2] + noise[3]) * 32.0f;
 }
 
-float simplex2(
-    float x, float y,
+static float octaves2(
+    const unsigned char *perm, float x, float y,
     int octaves, float persistence, float lacunarity)
 {
     float freq = 1.0f;
     float amp = 1.0f;
     float max = 1.0f;
-    float total = noise2(x, y);
+    float total = noise2(perm, x, y);
     int i;
     for (i = 1; i < octaves; i++) {
         freq *= lacunarity;
         amp *= persistence;
         max += amp;
-        total += noise2(x * freq, y * freq) * amp;
+        total += noise2(perm, x * freq, y * freq) * amp;
     }
     return (1 + total / max) / 2;
 }
 
-float simplex3(
-    float x, float y, float z,
+static float octaves3(
+    const unsigned char *perm, float x, float y, float z,
     int octaves, float persistence, float lacunarity)
 {
     float freq = 1.0f;
     float amp = 1.0f;
     float max = 1.0f;
-    float total = noise3(x, y, z);
+    float total = noise3(perm, x, y, z);
     int i;
     for (i = 1; i < octaves; ++i) {
         freq *= lacunarity;
         amp *= persistence;
         max += amp;
-        total += noise3(x * freq, y * freq, z * freq) * amp;
+        total += noise3(perm, x * freq, y * freq, z * freq) * amp;
     }
     return (1 + total / max) / 2;
 }
+
+float simplex2(
+    float x, float y,
+    int octaves, float persistence, float lacunarity)
+{
+    return octaves2(GLOBAL_PERM, x, y, octaves, persistence, lacunarity);
+}
+
+float simplex3(
+    float x, float y, float z,
+    int octaves, float persistence, float lacunarity)
+{
+    return octaves3(GLOBAL_PERM, x, y, z, octaves, persistence, lacunarity);
+}
+
+float noise_simplex2(
+    const NoiseContext *context, float x, float y,
+    int octaves, float persistence, float lacunarity)
+{
+    return octaves2(context->perm, x, y, octaves, persistence, lacunarity);
+}
+
+float noise_simplex3(
+    const NoiseContext *context, float x, float y, float z,
+    int octaves, float persistence, float lacunarity)
+{
+    return octaves3(context->perm, x, y, z, octaves, persistence, lacunarity);
+}
+
+#ifdef NOISE_SSE2
+
+/* The SSE2 versions of noise2() and noise3() do the same float operations in
+   the same order as the scalar code, 4 points at a time, so that the results
+   are bit-identical. Only the permutation table lookups are done per point. */
+
+static __m128 floor_ps(__m128 v) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 big = _mm_set1_ps(8388608.0f);
+    __m128 r = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+    r = _mm_sub_ps(r, _mm_and_ps(_mm_cmpgt_ps(r, v), one));
+    /* floorf(-0.0f) is -0.0f */
+    r = _mm_or_ps(r, _mm_and_ps(_mm_cmpeq_ps(r, _mm_setzero_ps()),
+        _mm_and_ps(v, sign)));
+    /* values of 2^23 or more are already whole numbers */
+    __m128 keep = _mm_cmpge_ps(_mm_andnot_ps(sign, v), big);
+    return _mm_or_ps(_mm_and_ps(keep, v), _mm_andnot_ps(keep, r));
+}
+
+/* f^4 * dot if f > 0, else 0 */
+static __m128 corner_ps(__m128 f, __m128 dot) {
+    __m128 n = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(_mm_mul_ps(f, f), f), f), dot);
+    return _mm_and_ps(_mm_cmpgt_ps(f, _mm_setzero_ps()), n);
+}
+
+static __m128 noise2_sse2(const unsigned char *perm, __m128 x, __m128 y) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    __m128 s = _mm_mul_ps(_mm_add_ps(x, y), _mm_set1_ps(F2));
+    __m128 i = floor_ps(_mm_add_ps(x, s));
+    __m128 j = floor_ps(_mm_add_ps(y, s));
+    __m128 t = _mm_mul_ps(_mm_add_ps(i, j), _mm_set1_ps(G2));
+    __m128 xx0 = _mm_sub_ps(x, _mm_sub_ps(i, t));
+    __m128 yy0 = _mm_sub_ps(y, _mm_sub_ps(j, t));
+    __m128 m1 = _mm_cmpgt_ps(xx0, yy0);
+    __m128 i1 = _mm_and_ps(m1, one);
+    __m128 j1 = _mm_andnot_ps(m1, one);
+    __m128 xx2 = _mm_sub_ps(_mm_add_ps(xx0, _mm_set1_ps(G2 * 2.0f)), one);
+    __m128 yy2 = _mm_sub_ps(_mm_add_ps(yy0, _mm_set1_ps(G2 * 2.0f)), one);
+    __m128 xx1 = _mm_add_ps(_mm_sub_ps(xx0, i1), _mm_set1_ps(G2));
+    __m128 yy1 = _mm_add_ps(_mm_sub_ps(yy0, j1), _mm_set1_ps(G2));
+
+    int ii[4], jj[4], c;
+    int mask = _mm_movemask_ps(m1);
+    float gx[3][4], gy[3][4];
+    _mm_storeu_si128((__m128i *)ii, _mm_cvttps_epi32(i));
+    _mm_storeu_si128((__m128i *)jj, _mm_cvttps_epi32(j));
+    for (c = 0; c < 4; c++) {
+        int I = ii[c] & 255;
+        int J = jj[c] & 255;
+        int a = (mask >> c) & 1;
+        int g0 = perm[I + perm[J]] % 12;
+        int g1 = perm[I + a + perm[J + !a]] % 12;
+        int g2 = perm[I + 1 + perm[J + 1]] % 12;
+        gx[0][c] = GRAD3[g0][0]; gy[0][c] = GRAD3[g0][1];
+        gx[1][c] = GRAD3[g1][0]; gy[1][c] = GRAD3[g1][1];
+        gx[2][c] = GRAD3[g2][0]; gy[2][c] = GRAD3[g2][1];
+    }
+
+    __m128 f0 = _mm_sub_ps(_mm_sub_ps(half, _mm_mul_ps(xx0, xx0)),
+        _mm_mul_ps(yy0, yy0));
+    __m128 f1 = _mm_sub_ps(_mm_sub_ps(half, _mm_mul_ps(xx1, xx1)),
+        _mm_mul_ps(yy1, yy1));
+    __m128 f2 = _mm_sub_ps(_mm_sub_ps(half, _mm_mul_ps(xx2, xx2)),
+        _mm_mul_ps(yy2, yy2));
+    __m128 n0 = corner_ps(f0, _mm_add_ps(
+        _mm_mul_ps(_mm_loadu_ps(gx[0]), xx0),
+        _mm_mul_ps(_mm_loadu_ps(gy[0]), yy0)));
+    __m128 n1 = corner_ps(f1, _mm_add_ps(
+        _mm_mul_ps(_mm_loadu_ps(gx[1]), xx1),
+        _mm_mul_ps(_mm_loadu_ps(gy[1]), yy1)));
+    __m128 n2 = corner_ps(f2, _mm_add_ps(
+        _mm_mul_ps(_mm_loadu_ps(gx[2]), xx2),
+        _mm_mul_ps(_mm_loadu_ps(gy[2]), yy2)));
+    return _mm_mul_ps(_mm_add_ps(_mm_add_ps(n0, n1), n2),
+        _mm_set1_ps(70.0f));
+}
+
+static __m128 dot3_ps(__m128 x, __m128 y, __m128 z, const float g[3][4]) {
+    return _mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(x, _mm_loadu_ps(g[0])),
+        _mm_mul_ps(y, _mm_loadu_ps(g[1]))),
+        _mm_mul_ps(z, _mm_loadu_ps(g[2])));
+}
+
+static __m128 f3_ps(__m128 x, __m128 y, __m128 z) {
+    return _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(_mm_set1_ps(0.6f),
+        _mm_mul_ps(x, x)), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+}
+
+static __m128 noise3_sse2(
+    const unsigned char *perm, __m128 x, __m128 y, __m128 z)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 s = _mm_mul_ps(_mm_add_ps(_mm_add_ps(x, y), z), _mm_set1_ps(F3));
+    __m128 i = floor_ps(_mm_add_ps(x, s));
+    __m128 j = floor_ps(_mm_add_ps(y, s));
+    __m128 k = floor_ps(_mm_add_ps(z, s));
+    __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(i, j), k), _mm_set1_ps(G3));
+    __m128 x0 = _mm_sub_ps(x, _mm_sub_ps(i, t));
+    __m128 y0 = _mm_sub_ps(y, _mm_sub_ps(j, t));
+    __m128 z0 = _mm_sub_ps(z, _mm_sub_ps(k, t));
+
+    /* the simplex corners, with the same comparisons as noise3() */
+    __m128 a = _mm_cmpge_ps(x0, y0);
+    __m128 b = _mm_cmpge_ps(y0, z0);
+    __m128 c = _mm_cmpge_ps(x0, z0);
+    __m128 o1x = _mm_and_ps(a, _mm_or_ps(b, c));
+    __m128 o1y = _mm_andnot_ps(a, b);
+    __m128 o1z = _mm_andnot_ps(b, _mm_or_ps(
+        _mm_andnot_ps(a, one), _mm_andnot_ps(c, one)));
+    __m128 o2x = _mm_or_ps(a, _mm_and_ps(b, c));
+    __m128 o2y = _mm_or_ps(_mm_and_ps(a, b), _mm_andnot_ps(a, one));
+    __m128 o2z = _mm_or_ps(_mm_andnot_ps(b, one),
+        _mm_andnot_ps(_mm_or_ps(a, c), one));
+    o1x = _mm_and_ps(o1x, one);
+    o1y = _mm_and_ps(o1y, one);
+    o1z = _mm_and_ps(_mm_cmpneq_ps(o1z, _mm_setzero_ps()), one);
+    o2x = _mm_and_ps(o2x, one);
+    o2y = _mm_and_ps(_mm_cmpneq_ps(o2y, _mm_setzero_ps()), one);
+    o2z = _mm_and_ps(_mm_cmpneq_ps(o2z, _mm_setzero_ps()), one);
+
+    __m128 x1 = _mm_add_ps(_mm_sub_ps(x0, o1x), _mm_set1_ps(G3));
+    __m128 y1 = _mm_add_ps(_mm_sub_ps(y0, o1y), _mm_set1_ps(G3));
+    __m128 z1 = _mm_add_ps(_mm_sub_ps(z0, o1z), _mm_set1_ps(G3));
+    __m128 x2 = _mm_add_ps(_mm_sub_ps(x0, o2x), _mm_set1_ps(2.0f * G3));
+    __m128 y2 = _mm_add_ps(_mm_sub_ps(y0, o2y), _mm_set1_ps(2.0f * G3));
+    __m128 z2 = _mm_add_ps(_mm_sub_ps(z0, o2z), _mm_set1_ps(2.0f * G3));
+    __m128 x3 = _mm_add_ps(_mm_sub_ps(x0, one), _mm_set1_ps(3.0f * G3));
+    __m128 y3 = _mm_add_ps(_mm_sub_ps(y0, one), _mm_set1_ps(3.0f * G3));
+    __m128 z3 = _mm_add_ps(_mm_sub_ps(z0, one), _mm_set1_ps(3.0f * G3));
+
+    int ii[4], jj[4], kk[4], n;
+    float o[6][4];
+    float g[4][3][4];
+    _mm_storeu_si128((__m128i *)ii, _mm_cvttps_epi32(i));
+    _mm_storeu_si128((__m128i *)jj, _mm_cvttps_epi32(j));
+    _mm_storeu_si128((__m128i *)kk, _mm_cvttps_epi32(k));
+    _mm_storeu_ps(o[0], o1x);
+    _mm_storeu_ps(o[1], o1y);
+    _mm_storeu_ps(o[2], o1z);
+    _mm_storeu_ps(o[3], o2x);
+    _mm_storeu_ps(o[4], o2y);
+    _mm_storeu_ps(o[5], o2z);
+    for (n = 0; n < 4; n++) {
+        int I = ii[n] & 255;
+        int J = jj[n] & 255;
+        int K = kk[n] & 255;
+        int a0 = (int)o[0][n], a1 = (int)o[1][n], a2 = (int)o[2][n];
+        int b0 = (int)o[3][n], b1 = (int)o[4][n], b2 = (int)o[5][n];
+        int h[4], c;
+        h[0] = perm[I + perm[J + perm[K]]] % 12;
+        h[1] = perm[I + a0 + perm[J + a1 + perm[a2 + K]]] % 12;
+        h[2] = perm[I + b0 + perm[J + b1 + perm[b2 + K]]] % 12;
+        h[3] = perm[I + 1 + perm[J + 1 + perm[K + 1]]] % 12;
+        for (c = 0; c < 4; c++) {
+            g[c][0][n] = GRAD3[h[c]][0];
+            g[c][1][n] = GRAD3[h[c]][1];
+            g[c][2][n] = GRAD3[h[c]][2];
+        }
+    }
+
+    __m128 n0 = corner_ps(f3_ps(x0, y0, z0), dot3_ps(x0, y0, z0, g[0]));
+    __m128 n1 = corner_ps(f3_ps(x1, y1, z1), dot3_ps(x1, y1, z1, g[1]));
+    __m128 n2 = corner_ps(f3_ps(x2, y2, z2), dot3_ps(x2, y2, z2, g[2]));
+    __m128 n3 = corner_ps(f3_ps(x3, y3, z3), dot3_ps(x3, y3, z3, g[3]));
+    return _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_add_ps(n0, n1), n2), n3),
+        _mm_set1_ps(32.0f));
+}
+
+#endif
+
+void noise_simplex2_batch(
+    const NoiseContext *context, const float *x, const float *y,
+    float *out, int count,
+    int octaves, float persistence, float lacunarity)
+{
+    int n = 0;
+#ifdef NOISE_SSE2
+    for (; n + 4 <= count; n += 4) {
+        __m128 px = _mm_loadu_ps(x + n);
+        __m128 py = _mm_loadu_ps(y + n);
+        float freq = 1.0f;
+        float amp = 1.0f;
+        float max = 1.0f;
+        __m128 total = noise2_sse2(context->perm, px, py);
+        int i;
+        for (i = 1; i < octaves; i++) {
+            freq *= lacunarity;
+            amp *= persistence;
+            max += amp;
+            __m128 f = _mm_set1_ps(freq);
+            total = _mm_add_ps(total, _mm_mul_ps(noise2_sse2(context->perm,
+                _mm_mul_ps(px, f), _mm_mul_ps(py, f)), _mm_set1_ps(amp)));
+        }
+        __m128 r = _mm_add_ps(_mm_set1_ps(1.0f),
+            _mm_div_ps(total, _mm_set1_ps(max)));
+        _mm_storeu_ps(out + n, _mm_div_ps(r, _mm_set1_ps(2.0f)));
+    }
+#endif
+    for (; n < count; n++) {
+        out[n] = octaves2(
+            context->perm, x[n], y[n], octaves, persistence, lacunarity);
+    }
+}
+
+void noise_simplex3_batch(
+    const NoiseContext *context, const float *x, const float *y,
+    const float *z, float *out, int count,
+    int octaves, float persistence, float lacunarity)
+{
+    int n = 0;
+#ifdef NOISE_SSE2
+    for (; n + 4 <= count; n += 4) {
+        __m128 px = _mm_loadu_ps(x + n);
+        __m128 py = _mm_loadu_ps(y + n);
+        __m128 pz = _mm_loadu_ps(z + n);
+        float freq = 1.0f;
+        float amp = 1.0f;
+        float max = 1.0f;
+        __m128 total = noise3_sse2(context->perm, px, py, pz);
+        int i;
+        for (i = 1; i < octaves; i++) {
+            freq *= lacunarity;
+            amp *= persistence;
+            max += amp;
+            __m128 f = _mm_set1_ps(freq);
+            total = _mm_add_ps(total, _mm_mul_ps(noise3_sse2(context->perm,
+                _mm_mul_ps(px, f), _mm_mul_ps(py, f), _mm_mul_ps(pz, f)),
+                _mm_set1_ps(amp)));
+        }
+        __m128 r = _mm_add_ps(_mm_set1_ps(1.0f),
+            _mm_div_ps(total, _mm_set1_ps(max)));
+        _mm_storeu_ps(out + n, _mm_div_ps(r, _mm_set1_ps(2.0f)));
+    }
+#endif
+    for (; n < count; n++) {
+        out[n] = octaves3(context->perm, x[n], y[n], z[n],
+            octaves, persistence, lacunarity);
+    }
+}
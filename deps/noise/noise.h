@@ -27,6 +27,39 @@ SOFTWARE.
 #ifndef _noise_h_
 #define _noise_h_
 
+/* The noise of one seed. The noise_* functions only read the context, so
+   any number of threads can share one. */
+typedef struct {
+    unsigned char perm[512];
+} NoiseContext;
+
+/* Noise with the default (unseeded) permutation table */
+void noise_init(NoiseContext *context);
+
+/* Noise that only depends on the given seed */
+void noise_seed(NoiseContext *context, unsigned int x);
+
+float noise_simplex2(
+    const NoiseContext *context, float x, float y,
+    int octaves, float persistence, float lacunarity);
+
+float noise_simplex3(
+    const NoiseContext *context, float x, float y, float z,
+    int octaves, float persistence, float lacunarity);
+
+/* Evaluate noise_simplex2() or noise_simplex3() for count points at once.
+   The results are bit-identical to calling them for each point. */
+void noise_simplex2_batch(
+    const NoiseContext *context, const float *x, const float *y,
+    float *out, int count,
+    int octaves, float persistence, float lacunarity);
+
+void noise_simplex3_batch(
+    const NoiseContext *context, const float *x, const float *y,
+    const float *z, float *out, int count,
+    int octaves, float persistence, float lacunarity);
+
+/* Global noise state, kept for old callers. seed() is not thread-safe. */
 void seed(unsigned int x);
 
 float simplex2(
@@ -263,9 +263,7 @@ class Model(object):
         for query in queries:
             self.execute(query)
     def get_default_block(self, x, y, z):
-        p, q = chunked(x), chunked(z)
-        chunk = self.world.get_chunk(p, q)
-        return chunk.get((x, y, z), 0)
+        return self.world.get_block(x, y, z)
     def get_block(self, x, y, z):
         query = (
             'select w from block where '
@@ -638,7 +636,6 @@ def cleanup():
     delete_query = 'delete from block where x = %d and y = %d and z = %d;'
     print('begin;')
     for p, q in chunks:
-        chunk = world.create_chunk(p, q)
         query = 'select x, y, z, w from block where p = :p and q = :q;'
         rows = conn.execute(query, {'p': p, 'q': q})
         for x, y, z, w in rows:
@@ -647,7 +644,7 @@ def cleanup():
             total += 1
             if (x, y, z) == last:
                 continue
-            original = chunk.get((x, y, z), 0)
+            original = world.get_block(x, y, z)
             if w == original or original in INDESTRUCTIBLE_ITEMS:
                 count += 1
                 print(delete_query % (x, y, z))
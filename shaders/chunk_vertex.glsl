@@ -0,0 +1,70 @@
+#version 120
+
+uniform mat4 matrix;
+uniform vec3 camera;
+uniform vec3 origin;
+uniform float fog_distance;
+uniform int ortho;
+
+// packed ChunkVertex (see Chunk.h)
+attribute vec4 position; // block corner in the mesh section, face
+attribute vec4 uv;       // tile, ao * 32, light * 60
+
+varying vec2 fragment_uv;
+varying vec2 fragment_tile;
+varying float fragment_ao;
+varying float fragment_light;
+varying float fog_factor;
+varying float fog_height;
+varying float diffuse;
+
+const float pi = 3.14159265;
+const vec3 light_direction = normalize(vec3(-1.0, 1.0, -1.0));
+
+void main() {
+    vec3 corner = position.xyz;
+    vec3 world = origin + corner;
+    gl_Position = matrix * vec4(world, 1.0);
+    // normal and texture coordinates (in blocks) of each face, as in make_box
+    float face = position.w;
+    vec3 normal;
+    if (face < 0.5) {
+        normal = vec3(-1.0, 0.0, 0.0);
+        fragment_uv = vec2(-corner.z, corner.y);
+    }
+    else if (face < 1.5) {
+        normal = vec3(1.0, 0.0, 0.0);
+        fragment_uv = vec2(corner.z, corner.y);
+    }
+    else if (face < 2.5) {
+        normal = vec3(0.0, 1.0, 0.0);
+        fragment_uv = vec2(-corner.x, -corner.z);
+    }
+    else if (face < 3.5) {
+        normal = vec3(0.0, -1.0, 0.0);
+        fragment_uv = vec2(-corner.x, corner.z);
+    }
+    else if (face < 4.5) {
+        normal = vec3(0.0, 0.0, -1.0);
+        fragment_uv = vec2(-corner.x, corner.y);
+    }
+    else {
+        normal = vec3(0.0, 0.0, 1.0);
+        fragment_uv = vec2(corner.x, corner.y);
+    }
+    fragment_tile = vec2(mod(uv.x, 16.0), floor(uv.x / 16.0));
+    fragment_ao = 0.3 + (1.0 - uv.y / 32.0) * 0.7;
+    fragment_light = uv.z / 60.0;
+    diffuse = max(0.0, dot(normal, light_direction));
+    if (bool(ortho)) {
+        fog_factor = 0.0;
+        fog_height = 0.0;
+    }
+    else {
+        float camera_distance = distance(camera, world);
+        fog_factor = pow(clamp(camera_distance / fog_distance, 0.0, 1.0), 4.0);
+        float dy = world.y - camera.y;
+        float dx = distance(world.xz, camera.xz);
+        fog_height = (atan(dy, dx) + pi / 2) / pi;
+    }
+}
@@ -1,25 +1,64 @@
 #ifndef _Chunk_h
 #define _Chunk_h
 
+#include "blockmap.h"
+#include "config.h"
+#include "heightmap.h"
 #include "map.h"
 #include "sign.h"
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#define CHUNK_MESH_SECTIONS (BLOCK_MAP_HEIGHT / CHUNK_MESH_HEIGHT)
+
+// Chunk.dirty bits
+#define CHUNK_DIRTY_ALL ((1 << CHUNK_MESH_SECTIONS) - 1)
+#define CHUNK_DIRTY_SIGNS (1 << CHUNK_MESH_SECTIONS)
+
+// Packed vertex of a block face in a chunk mesh (see make_chunk_quad()).
+// Each face is a quad of 4 vertices drawn with the shared quad index buffer.
+// The texture coordinates are found from the position in the chunk shader.
+typedef struct {
+    GLubyte x;       // block corner relative to the mesh section (0 to 32)
+    GLubyte y;
+    GLubyte z;
+    GLubyte face;    // face direction (0 to 5, in the order of make_box())
+    GLubyte tile;    // texture tile
+    GLubyte ao;      // ambient occlusion * 32
+    GLubyte light;   // light * 60 (at most 60)
+    GLubyte unused;
+} ChunkVertex;
+
+// Mesh for one vertical section of a chunk
+typedef struct {
+    GLuint buffer;        // block faces (ChunkVertex quads)
+    GLuint plant_buffer;  // plant faces (floats, like items)
+    int faces;       // number of block faces
+    int plant_faces; // number of plant faces
+    int miny;        // minimum Y value held by any block face
+    int maxy;        // maximum Y value held by any block face
+} ChunkMesh;
+
 // World chunk data (big area of blocks)
 typedef struct {
-    Map map;         // block types
-    Map lights;      // block lights
+    BlockMap map;    // block types
+    Map lights;      // light sources
+    BlockMap light_levels;  // light level of each block (see light.h)
     Map damage;      // block damage
+    Heightmap heightmap;  // top of each column
     SignList signs;  // signs in the chunk
     int p;           // chunk X
     int q;           // chunk Z
-    int faces;       // number of block faces
+    int faces;       // number of block faces (in all sections)
     int sign_faces;  // number of sign faces
-    int dirty;       // flag
-    int miny;        // minimum Y value held by any block
-    int maxy;        // maximum Y value held by any block
-    GLuint buffer;
+    int dirty;       // bit mask of mesh sections to generate (CHUNK_DIRTY_*)
+    int job;         // id of the worker item in progress (0 if none)
+    int loaded;      // non-zero once the blocks and lights have been loaded
+    int generated;   // non-zero once the chunk has been generated
+    int miny;        // minimum Y value held by any block face
+    int maxy;        // maximum Y value held by any block face
+    ChunkMesh meshes[CHUNK_MESH_SECTIONS];
+    ChunkMesh clouds;  // cloud layer, made once when the chunk is loaded
     GLuint sign_buffer;
 } Chunk;
 
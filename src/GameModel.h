@@ -3,8 +3,9 @@
 
 
 #include "config.h"
+#include "light.h"
 #include "map.h"
-#include "Worker.h"
+#include "scheduler.h"
 #include "Block.h"
 #include "Chunk.h"
 #include "Physics.h"
@@ -14,6 +15,7 @@
 
 
 #define MAX_CHUNKS 8192
+#define CHUNK_INDEX_SIZE (MAX_CHUNKS * 2)  // must be a power of 2
 #define MAX_PLAYERS 128
 #define MAX_TEXT_LENGTH 256
 #define MAX_PATH_LENGTH 256
@@ -22,9 +24,18 @@
 
 // Program state model
 // - window:
-// - workers:
+// - scheduler: worker threads that load and generate chunks
+// - item: worker item for chunks generated on the main thread
+// - scratch: meshing memory for chunks generated on the main thread
+// - light: light engine that keeps the chunks' light levels up to date
+// - light_chunk: chunk of the last block the light engine used
+// - noise: world generation noise, shared by all worker items
+// - generator: terrain generator of the current world (WORLD_GEN_*)
+// - quad_buffer: index buffer shared by all chunk meshes (see gen_quad_indices())
+// - quad_capacity: number of quads that quad_buffer can draw
 // - chunks:
 // - chunk_count:
+// - chunk_index: hash table of chunk positions (see chunk_index_slot())
 // - create_radius:
 // - render_radius:
 // - delete_radius:
@@ -58,9 +69,18 @@
 // - copy1:
 typedef struct {
     GLFWwindow *window;
-    Worker workers[WORKERS];
+    Scheduler scheduler;
+    WorkerItem item;
+    ChunkScratch scratch;
+    LightEngine light;
+    Chunk *light_chunk;
+    NoiseContext noise;
+    int generator;
+    GLuint quad_buffer;
+    int quad_capacity;
     Chunk chunks[MAX_CHUNKS];
     int chunk_count;
+    int chunk_index[CHUNK_INDEX_SIZE];
     int create_radius;
     int render_radius;
     int delete_radius;
@@ -4,38 +4,86 @@
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <stdint.h>
 #include <tinycthread.h>
+#include "Chunk.h"
+#include "blockmap.h"
+#include "heightmap.h"
+#include "map.h"
+#include "noise.h"
 
 
-enum {
-    WORKER_IDLE = 0,
-    WORKER_BUSY = 1,
-    WORKER_DONE = 2,
-};
+#define MAX_WORKERS 64
+#define JOBS_PER_WORKER 2
+#define MAX_WORKER_ITEMS (MAX_WORKERS * JOBS_PER_WORKER)
+
+
+// Generated vertex data for one mesh section of a chunk
+typedef struct {
+    int miny;
+    int maxy;
+    int faces;
+    int plant_faces;
+    ChunkVertex *data;
+    GLfloat *plant_data;
+} WorkerMesh;
 
 
 // A single item that a Worker can work on
 typedef struct {
+    int id;                  // job id (see Chunk.job)
     int p;                   // chunked X
     int q;                   // chunked Z
     int load;
-    Map *block_maps[3][3];
-    Map *light_maps[3][3];
-    Map *damage_maps[3][3];
-    int miny;
-    int maxy;
-    int faces;
-    GLfloat *data;
+    int sections;            // Chunk.dirty bits to generate
+    const NoiseContext *noise;   // world generation noise (shared, read only)
+    int generator;           // terrain generator (WORLD_GEN_*)
+    BlockMap *block_map;     // blocks of the chunk and its one block border
+    BlockMap *level_maps[3][3];  // light levels of the chunk and neighbors
+    Map *light_map;          // light sources
+    Map *damage_map;
+    Heightmap heightmap;     // heightmap of a loaded chunk
+    WorkerMesh meshes[CHUNK_MESH_SECTIONS];
+    ChunkVertex *data;       // vertex data for all meshes, reused by each job
+    int capacity;            // number of faces that fit in data
+    GLfloat *plant_data;     // plant vertex data for all meshes
+    int plant_capacity;      // number of faces that fit in plant_data
+    ChunkVertex *cloud_data; // cloud vertex data (CLOUD_MAX_FACES), for loads
+    int cloud_faces;
 } WorkerItem;
 
 
+// Memory that compute_chunk() works in, allocated once per thread and kept
+// all zero between jobs so that it does not need to be allocated or cleared
+// for every chunk.
+typedef struct {
+    char *opaque;
+    char *light;
+    char *highest;
+    char *shade;             // sky shade of the chunk's columns (SHADE())
+    int *greedy;             // face keys for greedy meshing (GREEDY_MESHING)
+    uint64_t *opaque_bits;   // column masks of opaque blocks
+    uint64_t *own_bits;      // column masks of the chunk's blocks
+    uint64_t *plant_bits;    // column masks of the chunk's plants
+    uint64_t *face_bits;     // column masks of exposed faces, per direction
+    uint64_t *exposed_bits;  // column masks of blocks with an exposed face
+} ChunkScratch;
+
+
+struct Scheduler;
+
+
+// A worker thread and its queue of items that are waiting to be worked on.
+// Other workers steal from the queue when their own queue is empty.
 typedef struct {
     int index;
-    int state;
-    thrd_t thrd;      // thread
-    mtx_t mtx;        // mutex
-    cnd_t cnd;        // condition
-    WorkerItem item;
+    thrd_t thrd;                             // thread
+    mtx_t mtx;                               // mutex for the queue
+    WorkerItem *queue[MAX_WORKER_ITEMS];     // ring of queued items
+    int queue_start;
+    int queue_size;
+    struct Scheduler *scheduler;
+    ChunkScratch scratch;                    // meshing memory of the thread
 } Worker;
 
 
@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bake.h"
+
+// This file contains the baked chunk format.
+// A baked chunk is laid out as:
+// - version (BAKE_VERSION) and terrain generator (WORLD_GEN_*), 1 byte each
+// - heightmap: the opaque and then the obstacle tops of the columns (see
+//   Heightmap), 2 bytes each, plus one so that an empty column is 0
+// - light sources: count (2 bytes), then x, y, z, w of each light with x, y, z
+//   relative to the origin of the light map, 1 byte each
+// - blocks: the sections of the block map (see block_map_write())
+// Multi-byte values are little-endian.
+
+#define BAKE_HEADER 2
+#define BAKE_COLUMNS (CHUNK_SIZE * CHUNK_SIZE)
+#define BAKE_HEIGHTS (BAKE_COLUMNS * 2 * 2)
+
+// Make the baked data of a chunk
+// Arguments:
+// - blocks: block map of the chunk
+// - lights: light sources of the chunk
+// - heightmap: heightmap of the chunk
+// - generator: terrain generator of the world
+// - data: output, newly allocated baked data to be freed by the caller
+// Returns:
+// - size of the baked data in bytes
+int bake_chunk(
+        const BlockMap *blocks,
+        const Map *lights,
+        const Heightmap *heightmap,
+        int generator,
+        unsigned char **data)
+{
+    // entries of a map are never 0
+    int light_count = lights->size;
+    int size = BAKE_HEADER + BAKE_HEIGHTS + 2 + light_count * 4 +
+        block_map_write(blocks, NULL);
+    unsigned char *out = (unsigned char *)malloc(size);
+    *data = out;
+    *out++ = BAKE_VERSION;
+    *out++ = generator;
+    const short *tops[2] = {heightmap->opaque, heightmap->obstacle};
+    for (int j = 0; j < 2; j++) {
+        for (int i = 0; i < BAKE_COLUMNS; i++) {
+            int h = tops[j][i] + 1;
+            *out++ = h & 0xff;
+            *out++ = h >> 8;
+        }
+    }
+    *out++ = light_count & 0xff;
+    *out++ = light_count >> 8;
+    MAP_FOR_EACH(lights, ex, ey, ez, ew) {
+        if (ew) {
+            *out++ = ex - lights->dx;
+            *out++ = ey - lights->dy;
+            *out++ = ez - lights->dz;
+            *out++ = ew;
+        }
+    } END_MAP_FOR_EACH;
+    block_map_write(blocks, out);
+    return size;
+}
+
+// Load a chunk from its baked data
+// Arguments:
+// - data: baked data from bake_chunk()
+// - size: size of the baked data in bytes
+// - generator: terrain generator of the world
+// - blocks: empty block map of the chunk to load the blocks into
+// - lights: light map of the chunk to add the light sources to
+// - heightmap: output, heightmap of the chunk, may be NULL
+// Returns:
+// - non-zero if the chunk was loaded, zero if the data was baked with another
+//   version or generator or is not valid (nothing is loaded then)
+int unbake_chunk(
+        const unsigned char *data,
+        int size,
+        int generator,
+        BlockMap *blocks,
+        Map *lights,
+        Heightmap *heightmap)
+{
+    if (size < BAKE_HEADER + BAKE_HEIGHTS + 2) {
+        return 0;
+    }
+    if (data[0] != BAKE_VERSION || data[1] != generator) {
+        return 0;
+    }
+    const unsigned char *in = data + BAKE_HEADER + BAKE_HEIGHTS;
+    int light_count = in[0] | (in[1] << 8);
+    in += 2;
+    int offset = in - data + light_count * 4;
+    if (offset > size) {
+        return 0;
+    }
+    if (block_map_read(blocks, data + offset, size - offset) < 0) {
+        return 0;
+    }
+    for (int i = 0; i < light_count; i++, in += 4) {
+        map_set(lights, in[0] + lights->dx, in[1] + lights->dy,
+            in[2] + lights->dz, (signed char)in[3]);
+    }
+    if (heightmap) {
+        // block maps of chunks start one block before the chunk
+        heightmap->x = blocks->dx + 1;
+        heightmap->z = blocks->dz + 1;
+        short *tops[2] = {heightmap->opaque, heightmap->obstacle};
+        in = data + BAKE_HEADER;
+        for (int j = 0; j < 2; j++) {
+            for (int i = 0; i < BAKE_COLUMNS; i++, in += 2) {
+                tops[j][i] = (in[0] | (in[1] << 8)) - 1;
+            }
+        }
+    }
+    return 1;
+}
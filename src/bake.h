@@ -0,0 +1,31 @@
+#ifndef _bake_h_
+#define _bake_h_
+
+#include "blockmap.h"
+#include "heightmap.h"
+#include "map.h"
+
+// Version of the baked chunk format, baked data of other versions is ignored
+#define BAKE_VERSION 2
+
+// A baked chunk is a chunk as it is after loading: the generated terrain with
+// the saved edits applied, its light sources and its heightmap. It is stored
+// as one blob (see bake_chunk()), so that pregenerated chunks can be read
+// instead of generated.
+
+int bake_chunk(
+        const BlockMap *blocks,
+        const Map *lights,
+        const Heightmap *heightmap,
+        int generator,
+        unsigned char **data);
+
+int unbake_chunk(
+        const unsigned char *data,
+        int size,
+        int generator,
+        BlockMap *blocks,
+        Map *lights,
+        Heightmap *heightmap);
+
+#endif
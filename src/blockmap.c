@@ -0,0 +1,318 @@
+#include <stdlib.h>
+#include <string.h>
+#include "blockmap.h"
+
+// This file contains code for dense chunk block storage.
+// A BlockMap is split into sections that are BLOCK_SECTION_HEIGHT blocks tall,
+// and each section stores one palette index per cell, packed into as few bits
+// as the number of distinct block types in the section requires.
+
+static unsigned int empty_data = 0;
+
+// Shared section for all empty sections. It is never written to.
+static BlockSection empty_section = {0, 0, 0, 0, 1, {0}, &empty_data};
+
+// Get the number of data words needed for a section with the given index size
+static int section_words(int bits) {
+    int words = (BLOCK_SECTION_VOLUME * bits + 31) / 32;
+    return words ? words : 1;
+}
+
+// Allocate a new section with every cell set to zero
+// Returns:
+// - pointer to the new section
+static BlockSection *section_alloc(void) {
+    BlockSection *section = (BlockSection *)malloc(sizeof(BlockSection));
+    section->refs = 1;
+    section->count = 0;
+    section->bits = 0;
+    section->mask = 0;
+    section->palette_size = 1;
+    section->palette[0] = 0;
+    section->data = (unsigned int *)calloc(1, sizeof(unsigned int));
+    return section;
+}
+
+// Release a reference to a section, freeing it when it is no longer used
+static void section_free(BlockSection *section) {
+    if (section == &empty_section) {
+        return;
+    }
+    if (--section->refs) {
+        return;
+    }
+    free(section->data);
+    free(section);
+}
+
+// Make a private copy of a section that can be written to
+static BlockSection *section_clone(const BlockSection *src) {
+    BlockSection *section = (BlockSection *)malloc(sizeof(BlockSection));
+    memcpy(section, src, sizeof(BlockSection));
+    section->refs = 1;
+    int size = section_words(src->bits) * sizeof(unsigned int);
+    section->data = (unsigned int *)malloc(size);
+    memcpy(section->data, src->data, size);
+    return section;
+}
+
+// Store a palette index into a cell of a section
+static void section_put(BlockSection *section, int i, unsigned int index) {
+    unsigned int bit = i * section->bits;
+    unsigned int *word = section->data + (bit >> 5);
+    unsigned int shift = bit & 31;
+    *word = (*word & ~(section->mask << shift)) | (index << shift);
+}
+
+// Repack a section's indices with twice as many bits per index
+static void section_grow(BlockSection *section) {
+    int bits = section->bits ? section->bits * 2 : 1;
+    unsigned int *data = (unsigned int *)calloc(
+        section_words(bits), sizeof(unsigned int));
+    for (int i = 0; i < BLOCK_SECTION_VOLUME; i++) {
+        unsigned int bit = i * section->bits;
+        unsigned int index =
+            (section->data[bit >> 5] >> (bit & 31)) & section->mask;
+        bit = i * bits;
+        data[bit >> 5] |= index << (bit & 31);
+    }
+    free(section->data);
+    section->data = data;
+    section->bits = bits;
+    section->mask = (1u << bits) - 1;
+}
+
+// Find the palette index for a block value, adding it if it is missing
+// Returns:
+// - palette index of w
+static unsigned int section_palette_index(BlockSection *section, int w) {
+    for (int i = 0; i < section->palette_size; i++) {
+        if (section->palette[i] == w) {
+            return i;
+        }
+    }
+    if (section->palette_size > (int)section->mask) {
+        section_grow(section);
+    }
+    section->palette[section->palette_size] = w;
+    return section->palette_size++;
+}
+
+// Initialize an empty block map
+// Arguments:
+// - map: block map to initialize
+// - dx, dy, dz: world position of the map's (0, 0, 0) cell
+// Returns: none
+void block_map_alloc(BlockMap *map, int dx, int dy, int dz) {
+    map->dx = dx;
+    map->dy = dy;
+    map->dz = dz;
+    for (int i = 0; i < BLOCK_MAP_SECTIONS; i++) {
+        map->sections[i] = &empty_section;
+    }
+}
+
+// Free the sections of a block map (but not the given map pointer)
+void block_map_free(BlockMap *map) {
+    for (int i = 0; i < BLOCK_MAP_SECTIONS; i++) {
+        section_free(map->sections[i]);
+        map->sections[i] = &empty_section;
+    }
+}
+
+// Make dst a copy of src.
+// The copy shares its sections with src, so this does not copy any block
+// data. A section is duplicated later by whichever map first writes to it.
+void block_map_copy(BlockMap *dst, const BlockMap *src) {
+    dst->dx = src->dx;
+    dst->dy = src->dy;
+    dst->dz = src->dz;
+    for (int i = 0; i < BLOCK_MAP_SECTIONS; i++) {
+        BlockSection *section = src->sections[i];
+        if (section != &empty_section) {
+            section->refs++;
+        }
+        dst->sections[i] = section;
+    }
+}
+
+// Set the block value at a world position
+// Arguments:
+// - map: block map to modify
+// - x, y, z: world position
+// - w: block value
+// Returns:
+// - non-zero if the stored value changed
+int block_map_set(BlockMap *map, int x, int y, int z, int w) {
+    x -= map->dx;
+    y -= map->dy;
+    z -= map->dz;
+    if ((unsigned int)x >= BLOCK_MAP_WIDTH ||
+        (unsigned int)y >= BLOCK_MAP_HEIGHT ||
+        (unsigned int)z >= BLOCK_MAP_WIDTH)
+    {
+        return 0;
+    }
+    w = (signed char)w;
+    BlockSection **slot = map->sections + y / BLOCK_SECTION_HEIGHT;
+    BlockSection *section = *slot;
+    int i = BLOCK_SECTION_INDEX(x, y % BLOCK_SECTION_HEIGHT, z);
+    int previous = block_section_get(section, i);
+    if (previous == w) {
+        return 0;
+    }
+    if (section == &empty_section) {
+        section = *slot = section_alloc();
+    }
+    else if (section->refs > 1) {
+        section->refs--;
+        section = *slot = section_clone(section);
+    }
+    section_put(section, i, section_palette_index(section, w));
+    section->count += (w != 0) - (previous != 0);
+    if (!section->count) {
+        section_free(section);
+        *slot = &empty_section;
+    }
+    return 1;
+}
+
+// Get the block value at a world position
+// Returns:
+// - block value, or 0 if the position is outside of the map
+int block_map_get(const BlockMap *map, int x, int y, int z) {
+    x -= map->dx;
+    y -= map->dy;
+    z -= map->dz;
+    if ((unsigned int)x >= BLOCK_MAP_WIDTH ||
+        (unsigned int)y >= BLOCK_MAP_HEIGHT ||
+        (unsigned int)z >= BLOCK_MAP_WIDTH)
+    {
+        return 0;
+    }
+    const BlockSection *section = map->sections[y / BLOCK_SECTION_HEIGHT];
+    return block_section_get(
+        section, BLOCK_SECTION_INDEX(x, y % BLOCK_SECTION_HEIGHT, z));
+}
+
+// Get the number of non-empty cells in a block map
+int block_map_size(const BlockMap *map) {
+    int result = 0;
+    for (int i = 0; i < BLOCK_MAP_SECTIONS; i++) {
+        result += map->sections[i]->count;
+    }
+    return result;
+}
+
+// Get the number of bytes allocated for a block map's sections
+int block_map_memory(const BlockMap *map) {
+    int result = 0;
+    for (int i = 0; i < BLOCK_MAP_SECTIONS; i++) {
+        const BlockSection *section = map->sections[i];
+        if (section != &empty_section) {
+            result += sizeof(BlockSection);
+            result += section_words(section->bits) * sizeof(unsigned int);
+        }
+    }
+    return result;
+}
+
+// Serialize a block map's sections.
+// Each section is written as its index size in bits (255 for an empty
+// section), followed for non-empty sections by the number of non-zero cells
+// (2 bytes), the palette size minus one, the palette and the packed indices
+// (4 bytes per word). Multi-byte values are little-endian.
+// Arguments:
+// - map: block map to serialize
+// - data: output, or NULL to only get the size
+// Returns:
+// - number of bytes written
+int block_map_write(const BlockMap *map, unsigned char *data) {
+    int size = 0;
+    for (int i = 0; i < BLOCK_MAP_SECTIONS; i++) {
+        const BlockSection *section = map->sections[i];
+        if (section == &empty_section) {
+            if (data) {
+                data[size] = 255;
+            }
+            size++;
+            continue;
+        }
+        int words = section_words(section->bits);
+        if (data) {
+            unsigned char *out = data + size;
+            *out++ = section->bits;
+            *out++ = section->count & 0xff;
+            *out++ = section->count >> 8;
+            *out++ = section->palette_size - 1;
+            memcpy(out, section->palette, section->palette_size);
+            out += section->palette_size;
+            for (int j = 0; j < words; j++) {
+                unsigned int word = section->data[j];
+                *out++ = word & 0xff;
+                *out++ = (word >> 8) & 0xff;
+                *out++ = (word >> 16) & 0xff;
+                *out++ = word >> 24;
+            }
+        }
+        size += 4 + section->palette_size + words * 4;
+    }
+    return size;
+}
+
+// Load the sections of a block map from block_map_write() data.
+// Arguments:
+// - map: block map with no blocks, its sections are replaced
+// - data: serialized sections
+// - size: number of bytes of data
+// Returns:
+// - number of bytes read, or -1 if the data is not valid (the map is left
+//   empty)
+int block_map_read(BlockMap *map, const unsigned char *data, int size) {
+    int offset = 0;
+    for (int i = 0; i < BLOCK_MAP_SECTIONS; i++) {
+        if (offset >= size) {
+            block_map_free(map);
+            return -1;
+        }
+        int bits = data[offset];
+        if (bits == 255) {
+            offset++;
+            continue;
+        }
+        if ((bits & (bits - 1)) || bits > 8 || size - offset < 4) {
+            block_map_free(map);
+            return -1;
+        }
+        int count = data[offset + 1] | (data[offset + 2] << 8);
+        int palette_size = data[offset + 3] + 1;
+        int words = section_words(bits);
+        offset += 4;
+        if (palette_size > (1 << bits) || !count ||
+            count > BLOCK_SECTION_VOLUME ||
+            size - offset < palette_size + words * 4)
+        {
+            block_map_free(map);
+            return -1;
+        }
+        BlockSection *section = (BlockSection *)malloc(sizeof(BlockSection));
+        section->refs = 1;
+        section->count = count;
+        section->bits = bits;
+        section->mask = (1u << bits) - 1;
+        section->palette_size = palette_size;
+        memset(section->palette, 0, sizeof(section->palette));
+        memcpy(section->palette, data + offset, palette_size);
+        offset += palette_size;
+        section->data = (unsigned int *)malloc(words * sizeof(unsigned int));
+        for (int j = 0; j < words; j++, offset += 4) {
+            section->data[j] = data[offset] |
+                (data[offset + 1] << 8) |
+                (data[offset + 2] << 16) |
+                ((unsigned int)data[offset + 3] << 24);
+        }
+        section_free(map->sections[i]);
+        map->sections[i] = section;
+    }
+    return offset;
+}
@@ -0,0 +1,99 @@
+#ifndef _blockmap_h_
+#define _blockmap_h_
+
+#include "config.h"
+
+// Dimensions of the area covered by a BlockMap: one chunk plus a one block
+// border on every side in x and z, and the full world height in y.
+#define BLOCK_MAP_WIDTH (CHUNK_SIZE + 2)
+#define BLOCK_MAP_HEIGHT 256
+#define BLOCK_SECTION_HEIGHT 16
+#define BLOCK_MAP_SECTIONS (BLOCK_MAP_HEIGHT / BLOCK_SECTION_HEIGHT)
+#define BLOCK_SECTION_VOLUME \
+    (BLOCK_MAP_WIDTH * BLOCK_MAP_WIDTH * BLOCK_SECTION_HEIGHT)
+
+// Index of a cell within a section (z is the fastest changing coordinate)
+#define BLOCK_SECTION_INDEX(x, y, z) \
+    (((y) * BLOCK_MAP_WIDTH + (x)) * BLOCK_MAP_WIDTH + (z))
+
+// Iterate over every non-empty cell of a block map, in section order.
+// The body is given the absolute block position (ex, ey, ez) and value ew.
+#define BLOCK_MAP_FOR_EACH(map, ex, ey, ez, ew) \
+    BLOCK_MAP_FOR_EACH_IN_SECTIONS(map, 0, BLOCK_MAP_SECTIONS, ex, ey, ez, ew)
+
+// Iterate over the non-empty cells of the sections [start, end) of a block map
+#define BLOCK_MAP_FOR_EACH_IN_SECTIONS(map, start, end, ex, ey, ez, ew) \
+    for (int _s = (start); _s < (end); _s++) { \
+        const BlockSection *_section = (map)->sections[_s]; \
+        if (!_section->count) { \
+            continue; \
+        } \
+        int _i = 0; \
+        for (int _y = 0; _y < BLOCK_SECTION_HEIGHT; _y++) { \
+        for (int _x = 0; _x < BLOCK_MAP_WIDTH; _x++) { \
+        for (int _z = 0; _z < BLOCK_MAP_WIDTH; _z++, _i++) { \
+            int ew = block_section_get(_section, _i); \
+            if (!ew) { \
+                continue; \
+            } \
+            int ex = _x + (map)->dx; \
+            int ey = _y + _s * BLOCK_SECTION_HEIGHT + (map)->dy; \
+            int ez = _z + (map)->dz;
+
+#define END_BLOCK_MAP_FOR_EACH }}}}
+
+// A horizontal slice of a block map.
+// Cells are stored as bit-packed indices into a small palette of block ids,
+// so that a section made of a single block type needs no index data at all.
+// Sections are shared between copies of a map and are only duplicated when
+// a shared section is written to (copy-on-write).
+// - refs: number of block maps referencing this section
+// - count: number of non-zero cells
+// - bits: bits per packed index (0, 1, 2, 4 or 8)
+// - mask: (1 << bits) - 1
+// - palette_size: number of used palette entries
+// - palette: block ids referenced by the packed indices
+// - data: packed indices (32 / bits indices per word)
+typedef struct {
+    int refs;
+    int count;
+    int bits;
+    unsigned int mask;
+    int palette_size;
+    signed char palette[256];
+    unsigned int *data;
+} BlockSection;
+
+// Dense block storage for a chunk.
+// Empty sections all point to one shared read-only section instead of being
+// allocated, so lookups never need to check for a missing section.
+// Copies made with block_map_copy() share sections with the original. The
+// reference counts are not atomic, so copying, writing and freeing maps that
+// share sections must all happen on the same thread. Other threads may read
+// a copy as long as nobody writes to that copy.
+typedef struct {
+    int dx;
+    int dy;
+    int dz;
+    BlockSection *sections[BLOCK_MAP_SECTIONS];
+} BlockMap;
+
+// Get the value of the cell with the given index in a section
+static inline int block_section_get(const BlockSection *section, int i) {
+    unsigned int bit = i * section->bits;
+    unsigned int index =
+        (section->data[bit >> 5] >> (bit & 31)) & section->mask;
+    return section->palette[index];
+}
+
+void block_map_alloc(BlockMap *map, int dx, int dy, int dz);
+void block_map_free(BlockMap *map);
+void block_map_copy(BlockMap *dst, const BlockMap *src);
+int block_map_set(BlockMap *map, int x, int y, int z, int w);
+int block_map_get(const BlockMap *map, int x, int y, int z);
+int block_map_size(const BlockMap *map);
+int block_map_memory(const BlockMap *map);
+int block_map_write(const BlockMap *map, unsigned char *data);
+int block_map_read(BlockMap *map, const unsigned char *data, int size);
+
+#endif
@@ -14,7 +14,7 @@
 #define USE_CACHE 1
 #define DAY_LENGTH 600
 #define INVERT_MOUSE 0
-#define WORKERS 4              // Number of worker threads
+#define WORKERS 0              // Number of worker threads (0 = one per extra CPU core)
 
 // rendering options
 #define SHOW_LIGHTS 1
@@ -27,6 +27,7 @@
 #define SHOW_INFO_TEXT 1
 #define SHOW_CHAT_TEXT 1
 #define SHOW_PLAYER_NAMES 1
+#define GREEDY_MESHING 1       // Merge equal neighboring block faces into larger quads
 
 // key bindings
 #define CRAFT_KEY_FORWARD 'W'
@@ -52,6 +53,8 @@
 #define RENDER_SIGN_RADIUS 4
 #define DELETE_CHUNK_RADIUS 14
 #define CHUNK_SIZE 32
+#define CHUNK_MESH_HEIGHT 32   // Height of a chunk mesh section (multiple of 16)
+#define WORLD_GENERATOR 1      // Terrain generator of new offline worlds (WORLD_GEN_* in world.h)
 #define COMMIT_INTERVAL 5
 #define MAX_NAME_LENGTH 32
 
@@ -31,6 +31,84 @@ void make_cube(                   // writes specific values to the data pointer
 }
 
 
+// Corners of the faces of a unit cube, in the order of make_box()
+static const int quad_corners[6][4][3] = {
+    {{0, 0, 0}, {0, 0, 1}, {0, 1, 0}, {0, 1, 1}},
+    {{1, 0, 0}, {1, 0, 1}, {1, 1, 0}, {1, 1, 1}},
+    {{0, 1, 0}, {0, 1, 1}, {1, 1, 0}, {1, 1, 1}},
+    {{0, 0, 0}, {0, 0, 1}, {1, 0, 0}, {1, 0, 1}},
+    {{0, 0, 0}, {0, 1, 0}, {1, 0, 0}, {1, 1, 0}},
+    {{0, 0, 1}, {0, 1, 1}, {1, 0, 1}, {1, 1, 1}}
+};
+
+// Order of the corners around each face, so that the quad index buffer
+// draws the same triangles as make_box(). Starting one corner later gives
+// the flipped triangles.
+static const int quad_order[6][4] = {
+    {0, 1, 3, 2},
+    {0, 2, 3, 1},
+    {0, 1, 3, 2},
+    {0, 2, 3, 1},
+    {0, 1, 3, 2},
+    {0, 2, 3, 1}
+};
+
+
+// Make one packed block face of a chunk mesh, which may cover a rectangle of
+// blocks (as merged by greedy meshing)
+void make_chunk_quad(             // writes 4 vertices to the data pointer
+        ChunkVertex *data,        // output pointer
+        const float ao[4],        // ambient occlusion of the corners
+        const float light[4],     // light of the corners
+        int face,                 // face index, as in make_box()
+        int tile,                 // texture tile ID
+        int x,                    // lowest block corner in the mesh section
+        int y,
+        int z,
+        int sx,                   // size in blocks
+        int sy,
+        int sz)
+{
+    int flipped = (ao[0] + ao[3]) > (ao[1] + ao[2]);
+    for (int i = 0; i < 4; i++) {
+        int j = quad_order[face][(i + flipped) % 4];
+        ChunkVertex *v = data + i;
+        v->x = x + quad_corners[face][j][0] * sx;
+        v->y = y + quad_corners[face][j][1] * sy;
+        v->z = z + quad_corners[face][j][2] * sz;
+        v->face = face;
+        v->tile = tile;
+        v->ao = (int)(ao[j] * 32 + 0.5);
+        // light is at most 1 in the shader, but light sources have 10
+        v->light = (int)(MIN(light[j], 1) * 60 + 0.5);
+        v->unused = 0;
+    }
+}
+
+
+// Make the packed faces of a block in a chunk mesh
+void make_cube_quads(             // writes 4 vertices per face to the data pointer
+        ChunkVertex *data,        // output pointer
+        const float ao[6][4],
+        const float light[6][4],
+        const int faces[6],       // whether to generate each face
+        int x,                    // block position in the mesh section
+        int y,
+        int z,
+        int w)                    // block type
+{
+    for (int face = 0; face < 6; face++) {
+        if (!faces[face]) {
+            continue;
+        }
+        make_chunk_quad(
+                data, ao[face], light[face], face, blocks[w][face],
+                x, y, z, 1, 1, 1);
+        data += 4;
+    }
+}
+
+
 // Make a plant model
 void make_plant(       // writes specific values to the data pointer
         float *data,   // output pointer
@@ -1,6 +1,8 @@
 #ifndef _cube_h_
 #define _cube_h_
 
+#include "Chunk.h"
+
 
 void make_cube(
         float *data,
@@ -18,6 +20,29 @@ void make_cube(
         float n,
         int w);
 
+void make_chunk_quad(
+        ChunkVertex *data,
+        const float ao[4],
+        const float light[4],
+        int face,
+        int tile,
+        int x,
+        int y,
+        int z,
+        int sx,
+        int sy,
+        int sz);
+
+void make_cube_quads(
+        ChunkVertex *data,
+        const float ao[6][4],
+        const float light[6][4],
+        const int faces[6],
+        int x,
+        int y,
+        int z,
+        int w);
+
 void make_plant(
         float *data,
         const float ao,
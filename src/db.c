@@ -1,14 +1,25 @@
+#include "bake.h"
 #include "db.h"
+#include "edits.h"
 #include "ring.h"
 #include "sqlite3.h"
 #include "tinycthread.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 // Database code to save and load worlds.
 // Only player-made changes from the original generated world are saved in the db.
+// The changes are either stored as one row per block (DB_STORAGE_ROWS, the
+// block, light and block_damage tables) or as one blob of edits per chunk
+// (DB_STORAGE_CHUNKS, the chunk table, see edits.h). New worlds use chunk
+// storage, and db_migrate_chunks() moves the rows of older worlds over.
+// The database uses the WAL journal: the main connection writes (on the db
+// worker thread) while every thread that loads chunks reads from a read-only
+// connection of its own (see db_reader_begin()).
 
 static int db_enabled = 0;
+static int db_storage = DB_STORAGE_ROWS;
 
 static sqlite3 *db;
 static sqlite3_stmt *insert_block_stmt;
@@ -16,19 +27,84 @@ static sqlite3_stmt *insert_light_stmt;
 static sqlite3_stmt *insert_sign_stmt;
 static sqlite3_stmt *delete_sign_stmt;
 static sqlite3_stmt *delete_signs_stmt;
-static sqlite3_stmt *load_blocks_stmt;
-static sqlite3_stmt *load_lights_stmt;
 static sqlite3_stmt *load_signs_stmt;
 static sqlite3_stmt *get_key_stmt;
 static sqlite3_stmt *set_key_stmt;
-static sqlite3_stmt *load_block_damage_stmt;
 static sqlite3_stmt *insert_block_damage_stmt;
 static sqlite3_stmt *trim_block_damage_stmt;
+static sqlite3_stmt *save_bake_stmt;
+static sqlite3_stmt *save_chunk_stmt;
+
+// A connection to load chunks from, with its own load statements
+typedef struct {
+    sqlite3 *db;
+    sqlite3_stmt *load_blocks_stmt;
+    sqlite3_stmt *load_lights_stmt;
+    sqlite3_stmt *load_block_damage_stmt;
+    sqlite3_stmt *load_bake_stmt;
+    sqlite3_stmt *load_chunk_stmt;
+} DbReader;
+
+// Loads from the main connection, which must hold load_mtx
+static DbReader shared_reader;
+
+// The read connections of the loading threads, one per thread (tss_get() of
+// reader_key). They are closed by db_close() and opened again on the next
+// load, and reader_mtx guards the list of them.
+static char *db_path;
+static int db_wal = 0;
+static int readers_ready = 0;
+static tss_t reader_key;
+static mtx_t reader_mtx;
+static DbReader **readers = NULL;
+static int reader_count = 0;
+static int reader_capacity = 0;
+
+// Chunks with changes that are not committed yet, which only the main
+// connection and the batch of the db worker have. They are loaded from the
+// main connection instead of a read connection.
+// - commit: value of commits_queued when the chunk was last changed
+// The list and the commit counts are guarded by pending_mtx.
+typedef struct {
+    int p;
+    int q;
+    int commit;
+} DbPending;
+
+static DbPending *pending = NULL;
+static int pending_count = 0;
+static int pending_capacity = 0;
+static int commits_queued = 0;
+static int commits_done = 0;
+
+// Changes that the db worker has taken from the ring but not written yet,
+// one entry per chunk, sorted by (p, q). A change replaces the older change
+// of the same block, so that each block is written once. The batch is
+// written in (p, q) order before every commit, or sooner when it holds
+// DB_BATCH_EDITS changes, and loads from the main connection apply it on
+// top of what they read. The batch is guarded by load_mtx.
+#define DB_BATCH_EDITS 65536
+
+// Most ring entries that the db worker takes at a time
+#define DB_WORKER_ENTRIES 256
+
+// Capacity of the ring. Threads that put changes wait while it is full.
+#define DB_RING_SIZE 65536
+
+typedef struct {
+    int p;
+    int q;
+    ChunkEdits edits;
+} DbBatch;
+
+static DbBatch *batch = NULL;
+static int batch_count = 0;
+static int batch_capacity = 0;
+static int batch_edits = 0;
 
 static Ring ring;
 static thrd_t thrd;
-static mtx_t mtx;
-static cnd_t cnd;
+static mtx_t pending_mtx;
 static mtx_t load_mtx;
 
 
@@ -61,6 +137,209 @@ static int bail(int rc) {
 }
 
 
+// Prepare the load statements of a reader on its connection
+// Arguments:
+// - reader: reader with an open connection
+// Returns:
+// - sqlite result code
+static int db_reader_prepare(DbReader *reader) {
+    static const char *load_blocks_query =
+        "select x, y, z, w from block where p = ? and q = ?;";
+    static const char *load_lights_query =
+        "select x, y, z, w from light where p = ? and q = ?;";
+    static const char *load_block_damage_query =
+        "select x, y, z, w from block_damage where p = ? and q = ?;";
+    static const char *load_bake_query =
+        "select data from bake where p = ? and q = ?;";
+    static const char *load_chunk_query =
+        "select data from chunk where p = ? and q = ?;";
+    sqlite3 *db = reader->db;
+    int rc;
+    rc = sqlite3_prepare_v2(
+        db, load_blocks_query, -1, &reader->load_blocks_stmt, NULL);
+    if (rc) { return rc; }
+    rc = sqlite3_prepare_v2(
+        db, load_lights_query, -1, &reader->load_lights_stmt, NULL);
+    if (rc) { return rc; }
+    rc = sqlite3_prepare_v2(
+        db, load_block_damage_query, -1, &reader->load_block_damage_stmt,
+        NULL);
+    if (rc) { return rc; }
+    rc = sqlite3_prepare_v2(
+        db, load_bake_query, -1, &reader->load_bake_stmt, NULL);
+    if (rc) { return rc; }
+    rc = sqlite3_prepare_v2(
+        db, load_chunk_query, -1, &reader->load_chunk_stmt, NULL);
+    return rc;
+}
+
+
+// Finalize the load statements of a reader
+// Arguments:
+// - reader
+// Returns: none
+static void db_reader_finalize(DbReader *reader) {
+    sqlite3_finalize(reader->load_blocks_stmt);
+    sqlite3_finalize(reader->load_lights_stmt);
+    sqlite3_finalize(reader->load_block_damage_stmt);
+    sqlite3_finalize(reader->load_bake_stmt);
+    sqlite3_finalize(reader->load_chunk_stmt);
+    reader->load_blocks_stmt = NULL;
+    reader->load_lights_stmt = NULL;
+    reader->load_block_damage_stmt = NULL;
+    reader->load_bake_stmt = NULL;
+    reader->load_chunk_stmt = NULL;
+}
+
+
+// Close the read connection of a loading thread, if it is open
+// Arguments:
+// - reader
+// Returns: none
+static void db_reader_close(DbReader *reader) {
+    db_reader_finalize(reader);
+    sqlite3_close(reader->db);
+    reader->db = NULL;
+}
+
+
+// Open the read connection of a loading thread
+// Arguments:
+// - reader: reader with no open connection
+// Returns:
+// - non-zero if there was a database error
+static int db_reader_open(DbReader *reader) {
+    int rc = sqlite3_open_v2(db_path, &reader->db,
+        SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL);
+    if (!rc) {
+        sqlite3_busy_timeout(reader->db, 1000);
+        rc = db_reader_prepare(reader);
+    }
+    if (rc) {
+        fprintf(stderr, "read connection failed: %s\n",
+            sqlite3_errmsg(reader->db));
+        db_reader_close(reader);
+    }
+    return rc;
+}
+
+
+// Close and forget the read connection of a thread when the thread exits
+// (the destructor of reader_key)
+static void db_reader_free(void *arg) {
+    DbReader *reader = (DbReader *)arg;
+    mtx_lock(&reader_mtx);
+    db_reader_close(reader);
+    for (int i = 0; i < reader_count; i++) {
+        if (readers[i] == reader) {
+            readers[i] = readers[--reader_count];
+            break;
+        }
+    }
+    mtx_unlock(&reader_mtx);
+    free(reader);
+}
+
+
+// Get the read connection of the calling thread, opening it if needed
+// Arguments: none
+// Returns:
+// - the thread's reader, or NULL if its connection cannot be opened
+static DbReader *db_thread_reader() {
+    DbReader *reader = (DbReader *)tss_get(reader_key);
+    if (!reader) {
+        reader = (DbReader *)calloc(1, sizeof(DbReader));
+        tss_set(reader_key, reader);
+        mtx_lock(&reader_mtx);
+        if (reader_count == reader_capacity) {
+            reader_capacity = reader_capacity ? reader_capacity * 2 : 8;
+            readers = (DbReader **)realloc(
+                readers, sizeof(DbReader *) * reader_capacity);
+        }
+        readers[reader_count++] = reader;
+        mtx_unlock(&reader_mtx);
+    }
+    if (!reader->db && db_reader_open(reader)) {
+        return NULL;
+    }
+    return reader;
+}
+
+
+// Remember that a chunk has changes that are not committed yet. The caller
+// must hold pending_mtx. It is called before the change is put into the
+// ring, so a chunk is never loaded around a change that the worker has.
+// Marking and putting are not atomic with db_commit(), so the db_insert_*()
+// functions that mark chunks must run on the same thread as db_commit() (the
+// main thread). Otherwise a COMMIT could reach the ring before the change it
+// was counted after, and the chunk would be forgotten while its change is
+// still uncommitted.
+// Arguments:
+// - p: chunk x position
+// - q: chunk z position
+// Returns: none
+static void db_mark_pending(int p, int q) {
+    for (int i = 0; i < pending_count; i++) {
+        if (pending[i].p == p && pending[i].q == q) {
+            pending[i].commit = commits_queued;
+            return;
+        }
+    }
+    if (pending_count == pending_capacity) {
+        pending_capacity = pending_capacity ? pending_capacity * 2 : 64;
+        pending = (DbPending *)realloc(
+            pending, sizeof(DbPending) * pending_capacity);
+    }
+    pending[pending_count].p = p;
+    pending[pending_count].q = q;
+    pending[pending_count].commit = commits_queued;
+    pending_count++;
+}
+
+
+// Get the connection to load a chunk from. That is the calling thread's own
+// read connection, unless the chunk has changes that are not committed yet
+// or the database is not in WAL mode; then it is the main connection, and
+// load_mtx is held until db_reader_end().
+// Arguments:
+// - p: chunk x position
+// - q: chunk z position
+// Returns:
+// - reader to load the chunk with
+static DbReader *db_reader_begin(int p, int q) {
+    int shared = !db_wal;
+    mtx_lock(&pending_mtx);
+    for (int i = 0; !shared && i < pending_count; i++) {
+        shared = pending[i].p == p && pending[i].q == q;
+    }
+    mtx_unlock(&pending_mtx);
+    DbReader *reader = shared ? NULL : db_thread_reader();
+    if (!reader) {
+        mtx_lock(&load_mtx);
+        return &shared_reader;
+    }
+    return reader;
+}
+
+
+// Finish loading from a reader of db_reader_begin(). This resets the
+// statements, which ends the read transaction so that the WAL can be
+// checkpointed.
+// Arguments:
+// - reader
+// Returns: none
+static void db_reader_end(DbReader *reader) {
+    sqlite3_reset(reader->load_blocks_stmt);
+    sqlite3_reset(reader->load_lights_stmt);
+    sqlite3_reset(reader->load_block_damage_stmt);
+    sqlite3_reset(reader->load_bake_stmt);
+    sqlite3_reset(reader->load_chunk_stmt);
+    if (reader == &shared_reader) {
+        mtx_unlock(&load_mtx);
+    }
+}
+
+
 // Initialize a database stored in the a file with the given path (file may or may not exist).
 // If the file exists, this creates each database table only if it does not already exist.
 // Arguments:
@@ -116,6 +395,10 @@ int db_init(char *path) {
         "    face int not null,"
         "    text text not null"
         ");"
+        "create table if not exists world ("
+        "    name text not null,"
+        "    value int not null"
+        ");"
         "create table if not exists block_damage ("
         "    p int not null,"
         "    q int not null,"
@@ -124,12 +407,25 @@ int db_init(char *path) {
         "    z int not null,"
         "    w int not null"
         ");"
+        "create table if not exists bake ("
+        "    p int not null,"
+        "    q int not null,"
+        "    data blob not null"
+        ");"
+        "create table if not exists chunk ("
+        "    p int not null,"
+        "    q int not null,"
+        "    data blob not null"
+        ");"
         "create unique index if not exists block_pqxyz_idx on block (p, q, x, y, z);"
         "create unique index if not exists light_pqxyz_idx on light (p, q, x, y, z);"
         "create unique index if not exists key_pq_idx on key (p, q);"
         "create unique index if not exists sign_xyzface_idx on sign (x, y, z, face);"
         "create index if not exists sign_pq_idx on sign (p, q);"
-        "create unique index if not exists damage_pqxyz_idx on block_damage (p, q, x, y, z);";
+        "create unique index if not exists damage_pqxyz_idx on block_damage (p, q, x, y, z);"
+        "create unique index if not exists world_name_idx on world (name);"
+        "create unique index if not exists bake_pq_idx on bake (p, q);"
+        "create unique index if not exists chunk_pq_idx on chunk (p, q);";
     static const char *insert_block_query =
         "insert or replace into block (p, q, x, y, z, w) "
         "values (?, ?, ?, ?, ?, ?);";
@@ -143,10 +439,6 @@ int db_init(char *path) {
         "delete from sign where x = ? and y = ? and z = ? and face = ?;";
     static const char *delete_signs_query =
         "delete from sign where x = ? and y = ? and z = ?;";
-    static const char *load_blocks_query =
-        "select x, y, z, w from block where p = ? and q = ?;";
-    static const char *load_lights_query =
-        "select x, y, z, w from light where p = ? and q = ?;";
     static const char *load_signs_query =
         "select x, y, z, face, text from sign where p = ? and q = ?;";
     static const char *get_key_query =
@@ -154,19 +446,36 @@ int db_init(char *path) {
     static const char *set_key_query =
         "insert or replace into key (p, q, key) "
         "values (?, ?, ?);";
-    static const char *load_block_damage_query =
-        "select x, y, z, w from block_damage where p = ? and q = ?;";
     static const char *insert_block_damage_query =
         "insert or replace into block_damage (p, q, x, y, z, w) "
         "values (?, ?, ?, ?, ?, ?);";
     static const char *trim_block_damage_query =
         "delete from block_damage where w=0 and p=? and q=?;";
+    static const char *save_bake_query =
+        "insert or replace into bake (p, q, data) values (?, ?, ?);";
+    static const char *save_chunk_query =
+        "insert or replace into chunk (p, q, data) values (?, ?, ?);";
 
     int rc;
 
+    if (!readers_ready) {
+        tss_create(&reader_key, db_reader_free);
+        mtx_init(&reader_mtx, mtx_plain);
+        readers_ready = 1;
+    }
+    db_path = path;
+
     rc = sqlite3_open(path, &db);
     if (rc) { return bail(rc); }
 
+    sqlite3_stmt *stmt;
+    rc = sqlite3_prepare_v2(
+        db, "pragma journal_mode = wal;", -1, &stmt, NULL);
+    if (rc) { return bail(rc); }
+    db_wal = sqlite3_step(stmt) == SQLITE_ROW &&
+        !strcmp((const char *)sqlite3_column_text(stmt, 0), "wal");
+    sqlite3_finalize(stmt);
+
     rc = sqlite3_exec(db, create_query, NULL, NULL, NULL);
     if (rc) { return bail(rc); }
 
@@ -185,37 +494,44 @@ int db_init(char *path) {
     rc = sqlite3_prepare_v2(db, delete_signs_query, -1, &delete_signs_stmt, NULL);
     if (rc) { return bail(rc); }
 
-    rc = sqlite3_prepare_v2(db, load_blocks_query, -1, &load_blocks_stmt, NULL);
+    rc = sqlite3_prepare_v2(db, load_signs_query, -1, &load_signs_stmt, NULL);
     if (rc) { return bail(rc); }
 
-    rc = sqlite3_prepare_v2(db, load_lights_query, -1, &load_lights_stmt, NULL);
+    rc = sqlite3_prepare_v2(db, get_key_query, -1, &get_key_stmt, NULL);
     if (rc) { return bail(rc); }
 
-    rc = sqlite3_prepare_v2(db, load_signs_query, -1, &load_signs_stmt, NULL);
+    rc = sqlite3_prepare_v2(db, set_key_query, -1, &set_key_stmt, NULL);
     if (rc) { return bail(rc); }
 
-    rc = sqlite3_prepare_v2(db, get_key_query, -1, &get_key_stmt, NULL);
+    rc = sqlite3_prepare_v2(db, insert_block_damage_query, -1, &insert_block_damage_stmt, NULL);
     if (rc) { return bail(rc); }
 
-    rc = sqlite3_prepare_v2(db, set_key_query, -1, &set_key_stmt, NULL);
+    rc = sqlite3_prepare_v2(db, trim_block_damage_query, -1, &trim_block_damage_stmt, NULL);
     if (rc) { return bail(rc); }
 
-    rc = sqlite3_prepare_v2(db, load_block_damage_query, -1, &load_block_damage_stmt, NULL);
+    rc = sqlite3_prepare_v2(db, save_bake_query, -1, &save_bake_stmt, NULL);
     if (rc) { return bail(rc); }
 
-    rc = sqlite3_prepare_v2(db, insert_block_damage_query, -1, &insert_block_damage_stmt, NULL);
+    rc = sqlite3_prepare_v2(db, save_chunk_query, -1, &save_chunk_stmt, NULL);
     if (rc) { return bail(rc); }
 
-    rc = sqlite3_prepare_v2(db, trim_block_damage_query, -1, &trim_block_damage_stmt, NULL);
+    shared_reader.db = db;
+    rc = db_reader_prepare(&shared_reader);
     if (rc) { return bail(rc); }
 
+    if (!db_load_storage(&db_storage)) {
+        db_storage = db_is_new_world() ? DB_STORAGE_CHUNKS : DB_STORAGE_ROWS;
+        db_save_storage(db_storage);
+    }
+
     sqlite3_exec(db, "begin;", NULL, NULL, NULL);
     db_worker_start(NULL);
     return 0;
 }
 
 
-// Close the database and save pending commits
+// Close the database and save pending commits. No other thread may be
+// loading chunks at the time.
 // Arguments: none
 // Returns: none
 void db_close() {
@@ -227,27 +543,53 @@ void db_close() {
     sqlite3_finalize(insert_sign_stmt);
     sqlite3_finalize(delete_sign_stmt);
     sqlite3_finalize(delete_signs_stmt);
-    sqlite3_finalize(load_blocks_stmt);
-    sqlite3_finalize(load_lights_stmt);
     sqlite3_finalize(load_signs_stmt);
     sqlite3_finalize(get_key_stmt);
     sqlite3_finalize(set_key_stmt);
     sqlite3_finalize(insert_block_damage_stmt);
-    sqlite3_finalize(load_block_damage_stmt);
     sqlite3_finalize(trim_block_damage_stmt);
+    sqlite3_finalize(save_bake_stmt);
+    sqlite3_finalize(save_chunk_stmt);
+    db_reader_finalize(&shared_reader);
+    // the read connections close first so that the main connection
+    // checkpoints the WAL when it closes
+    mtx_lock(&reader_mtx);
+    for (int i = 0; i < reader_count; i++) {
+        db_reader_close(readers[i]);
+    }
+    mtx_unlock(&reader_mtx);
     sqlite3_close(db);
+    free(batch);
+    batch = NULL;
+    batch_capacity = 0;
+    free(pending);
+    pending = NULL;
+    pending_count = 0;
+    pending_capacity = 0;
 }
 
 
-// Let one of the workers do the database commit.
+// Let one of the workers do the database commit. It must be called on the
+// thread that queues the changes (see db_mark_pending()).
 // Arguments: none
 // Returns: none
 void db_commit() {
     if (!db_enabled) { return; }
-    mtx_lock(&mtx);
+    mtx_lock(&pending_mtx);
+    commits_queued++;
+    mtx_unlock(&pending_mtx);
     ring_put_commit(&ring);
-    cnd_signal(&cnd);
-    mtx_unlock(&mtx);
+}
+
+
+// Get the counters of the queue of changes for the db worker
+// Arguments:
+// - stats: output counters, all zero if the database is not enabled
+// Returns: none
+void db_queue_stats(RingStats *stats) {
+    memset(stats, 0, sizeof(RingStats));
+    if (!db_enabled) { return; }
+    ring_stats(&ring, stats);
 }
 
 
@@ -403,6 +745,167 @@ int db_load_state(
 }
 
 
+// Check whether the world is new, which is when it has no saved blocks and
+// no saved player state.
+// Arguments: none
+// Returns:
+// - non-zero if the world is new
+int db_is_new_world() {
+    if (!db_enabled) { return 1; }
+    static const char *query =
+        "select exists (select 1 from block) or exists (select 1 from chunk) "
+        "or exists (select 1 from state);";
+    int result = 1;
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        result = !sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return result;
+}
+
+
+// Save the terrain generator of the world.
+// Arguments:
+// - generator: world generator (WORLD_GEN_*)
+void db_save_generator(int generator) {
+    if (!db_enabled) { return; }
+    static const char *query =
+        "insert or replace into world (name, value) values ('generator', ?);";
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+    sqlite3_bind_int(stmt, 1, generator);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+
+// Load the terrain generator of the world.
+// Arguments:
+// - generator: pointer to world generator to load value into
+// Returns:
+// - non-zero if the world has a saved generator
+int db_load_generator(int *generator) {
+    if (!db_enabled) { return 0; }
+    static const char *query =
+        "select value from world where name = 'generator';";
+    int result = 0;
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        *generator = sqlite3_column_int(stmt, 0);
+        result = 1;
+    }
+    sqlite3_finalize(stmt);
+    return result;
+}
+
+
+// Save how the changes of the world are stored.
+// Arguments:
+// - storage: DB_STORAGE_ROWS or DB_STORAGE_CHUNKS
+void db_save_storage(int storage) {
+    if (!db_enabled) { return; }
+    static const char *query =
+        "insert or replace into world (name, value) values ('storage', ?);";
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+    sqlite3_bind_int(stmt, 1, storage);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+
+// Load how the changes of the world are stored.
+// Arguments:
+// - storage: pointer to storage (DB_STORAGE_*) to load value into
+// Returns:
+// - non-zero if the world has a saved storage
+int db_load_storage(int *storage) {
+    if (!db_enabled) { return 0; }
+    static const char *query =
+        "select value from world where name = 'storage';";
+    int result = 0;
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        *storage = sqlite3_column_int(stmt, 0);
+        result = 1;
+    }
+    sqlite3_finalize(stmt);
+    return result;
+}
+
+
+// Read the stored edits of a chunk (chunk storage).
+// Arguments:
+// - reader: reader to load with (see db_reader_begin())
+// - edits: output, edits of the chunk (to be freed with edits_free())
+// - p: chunk x position
+// - q: chunk z position
+// Returns:
+// - 0 if the edits were read or the chunk has none, -1 if the stored edits
+//   are not valid (the output edits are empty then)
+static int _db_read_edits(
+    DbReader *reader, ChunkEdits *edits, int p, int q)
+{
+    sqlite3_stmt *stmt = reader->load_chunk_stmt;
+    edits_alloc(edits, p, q);
+    sqlite3_reset(stmt);
+    sqlite3_bind_int(stmt, 1, p);
+    sqlite3_bind_int(stmt, 2, q);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        const unsigned char *data = sqlite3_column_blob(stmt, 0);
+        int size = sqlite3_column_bytes(stmt, 0);
+        if (edits_read(edits, data, size) < 0) {
+            fprintf(stderr, "invalid edits of chunk %d, %d\n", p, q);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+// Store the edits of a chunk (chunk storage), replacing the older edits.
+// Arguments:
+// - edits: edits to store, their damage edits of 0 are removed
+// - p: chunk x position
+// - q: chunk z position
+// Returns: none
+static void _db_write_edits(ChunkEdits *edits, int p, int q) {
+    edits_trim(edits);
+    int size = edits_write(edits, NULL);
+    unsigned char *data = malloc(size);
+    edits_write(edits, data);
+    sqlite3_reset(save_chunk_stmt);
+    sqlite3_bind_int(save_chunk_stmt, 1, p);
+    sqlite3_bind_int(save_chunk_stmt, 2, q);
+    sqlite3_bind_blob(save_chunk_stmt, 3, data, size, SQLITE_STATIC);
+    sqlite3_step(save_chunk_stmt);
+    sqlite3_reset(save_chunk_stmt);
+    free(data);
+}
+
+
+// Forget the chunks whose changes have all been committed, after the db
+// worker has done a commit.
+// Arguments: none
+// Returns: none
+static void db_forget_pending() {
+    mtx_lock(&pending_mtx);
+    commits_done++;
+    int count = 0;
+    for (int i = 0; i < pending_count; i++) {
+        if (pending[i].commit >= commits_done) {
+            pending[count++] = pending[i];
+        }
+    }
+    pending_count = count;
+    mtx_unlock(&pending_mtx);
+}
+
+
 // Let one of the workers insert a block into the database.
 // Arguments:
 // - p, q: chunk x, y position
@@ -410,10 +913,10 @@ int db_load_state(
 // - w: block id
 void db_insert_block(int p, int q, int x, int y, int z, int w) {
     if (!db_enabled) { return; }
-    mtx_lock(&mtx);
+    mtx_lock(&pending_mtx);
+    db_mark_pending(p, q);
+    mtx_unlock(&pending_mtx);
     ring_put_block(&ring, p, q, x, y, z, w);
-    cnd_signal(&cnd);
-    mtx_unlock(&mtx);
 }
 
 
@@ -439,10 +942,10 @@ static void _db_insert_block(int p, int q, int x, int y, int z, int w) {
 
 void db_insert_block_damage(int p, int q, int x, int y, int z, int damage) {
     if (!db_enabled) { return; }
-    mtx_lock(&mtx);
+    mtx_lock(&pending_mtx);
+    db_mark_pending(p, q);
+    mtx_unlock(&pending_mtx);
     ring_put_block_damage(&ring, p, q, x, y, z, damage);
-    cnd_signal(&cnd);
-    mtx_unlock(&mtx);
 }
 
 
@@ -461,10 +964,7 @@ static void _db_insert_block_damage(int p, int q, int x, int y, int z, int w) {
 
 void db_trim_block_damage(int p, int q) {
     if (!db_enabled) { return; }
-    mtx_lock(&mtx);
     ring_put_block_damage_trim(&ring, p, q);
-    cnd_signal(&cnd);
-    mtx_unlock(&mtx);
 }
 
 
@@ -487,10 +987,10 @@ static void _db_block_damage_trim(int p, int q) {
 // - w: light value
 void db_insert_light(int p, int q, int x, int y, int z, int w) {
     if (!db_enabled) { return; }
-    mtx_lock(&mtx);
+    mtx_lock(&pending_mtx);
+    db_mark_pending(p, q);
+    mtx_unlock(&pending_mtx);
     ring_put_light(&ring, p, q, x, y, z, w);
-    cnd_signal(&cnd);
-    mtx_unlock(&mtx);
 }
 
 
@@ -511,6 +1011,198 @@ static void _db_insert_light(int p, int q, int x, int y, int z, int w) {
 }
 
 
+// Find the batched changes of a chunk
+// Arguments:
+// - p: chunk x position
+// - q: chunk z position
+// - index: output, position of the chunk in the batch, or where it belongs
+// Returns:
+// - non-zero if the chunk has batched changes
+static int db_batch_find(int p, int q, int *index) {
+    static int last = 0;
+    // consecutive changes are mostly to the same chunk
+    if (last < batch_count && batch[last].p == p && batch[last].q == q) {
+        *index = last;
+        return 1;
+    }
+    int lo = 0;
+    int hi = batch_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        DbBatch *b = batch + mid;
+        if (b->p < p || (b->p == p && b->q < q)) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    *index = lo;
+    if (lo < batch_count && batch[lo].p == p && batch[lo].q == q) {
+        last = lo;
+        return 1;
+    }
+    return 0;
+}
+
+
+// Apply changes to the maps of a chunk
+// Arguments:
+// - edits
+// - map: block map, may be NULL
+// - lights: light map, may be NULL
+// - damage: block damage map, may be NULL
+// Returns:
+// - number of block changes
+static int db_apply_edits(
+    const ChunkEdits *edits, BlockMap *map, Map *lights, Map *damage)
+{
+    const EditList *list = edits->lists + EDIT_BLOCKS;
+    for (int i = 0; map && i < list->size; i++) {
+        int x, y, z;
+        edits_position(edits, list->data[i].index, &x, &y, &z);
+        block_map_set(map, x, y, z, list->data[i].w);
+    }
+    list = edits->lists + EDIT_LIGHTS;
+    for (int i = 0; lights && i < list->size; i++) {
+        int x, y, z;
+        edits_position(edits, list->data[i].index, &x, &y, &z);
+        map_set(lights, x, y, z, list->data[i].w);
+    }
+    list = edits->lists + EDIT_DAMAGE;
+    for (int i = 0; damage && i < list->size; i++) {
+        int x, y, z;
+        edits_position(edits, list->data[i].index, &x, &y, &z);
+        map_set(damage, x, y, z, list->data[i].w);
+    }
+    return edits->lists[EDIT_BLOCKS].size;
+}
+
+
+// Apply the batched changes of a chunk to its maps. The caller must hold
+// load_mtx.
+// Arguments:
+// - p: chunk x position
+// - q: chunk z position
+// - map: block map, may be NULL
+// - lights: light map, may be NULL
+// - damage: block damage map, may be NULL
+// Returns:
+// - number of block changes
+static int db_batch_load(
+    int p, int q, BlockMap *map, Map *lights, Map *damage)
+{
+    int index;
+    if (!db_batch_find(p, q, &index)) {
+        return 0;
+    }
+    return db_apply_edits(&batch[index].edits, map, lights, damage);
+}
+
+
+// Write the batched changes in (p, q) order and empty the batch. The caller
+// must hold load_mtx.
+// Arguments: none
+// Returns: none
+static void _db_batch_write() {
+    for (int i = 0; i < batch_count; i++) {
+        int p = batch[i].p;
+        int q = batch[i].q;
+        ChunkEdits *edits = &batch[i].edits;
+        if (db_storage == DB_STORAGE_CHUNKS) {
+            ChunkEdits stored;
+            if (_db_read_edits(&shared_reader, &stored, p, q) < 0) {
+                // never replace stored edits that could not be read
+                fprintf(stderr, "dropped the changes of chunk %d, %d\n",
+                    p, q);
+                edits_free(edits);
+                continue;
+            }
+            for (int kind = 0; kind < EDIT_KINDS; kind++) {
+                const EditList *list = edits->lists + kind;
+                for (int j = 0; j < list->size; j++) {
+                    int x, y, z;
+                    edits_position(edits, list->data[j].index, &x, &y, &z);
+                    edits_set(&stored, kind, x, y, z, list->data[j].w);
+                }
+            }
+            _db_write_edits(&stored, p, q);
+            edits_free(&stored);
+        }
+        else {
+            const EditList *list = edits->lists + EDIT_BLOCKS;
+            for (int j = 0; j < list->size; j++) {
+                int x, y, z;
+                edits_position(edits, list->data[j].index, &x, &y, &z);
+                _db_insert_block(p, q, x, y, z, list->data[j].w);
+            }
+            list = edits->lists + EDIT_LIGHTS;
+            for (int j = 0; j < list->size; j++) {
+                int x, y, z;
+                edits_position(edits, list->data[j].index, &x, &y, &z);
+                _db_insert_light(p, q, x, y, z, list->data[j].w);
+            }
+            list = edits->lists + EDIT_DAMAGE;
+            for (int j = 0; j < list->size; j++) {
+                int x, y, z;
+                edits_position(edits, list->data[j].index, &x, &y, &z);
+                _db_insert_block_damage(p, q, x, y, z, list->data[j].w);
+            }
+        }
+        edits_free(edits);
+    }
+    batch_count = 0;
+    batch_edits = 0;
+}
+
+
+// Add a change taken from the ring to the batch. The caller must hold
+// load_mtx.
+// Arguments:
+// - p: chunk x position
+// - q: chunk z position
+// - kind: EDIT_BLOCKS, EDIT_LIGHTS or EDIT_DAMAGE
+// - x, y, z: block position
+// - w: new value
+// Returns: none
+static void _db_batch_set(int p, int q, int kind, int x, int y, int z, int w) {
+    int index;
+    if (!db_batch_find(p, q, &index)) {
+        if (batch_count == batch_capacity) {
+            batch_capacity = batch_capacity ? batch_capacity * 2 : 64;
+            batch = (DbBatch *)realloc(
+                batch, sizeof(DbBatch) * batch_capacity);
+        }
+        memmove(batch + index + 1, batch + index,
+            sizeof(DbBatch) * (batch_count - index));
+        batch_count++;
+        batch[index].p = p;
+        batch[index].q = q;
+        edits_alloc(&batch[index].edits, p, q);
+    }
+    EditList *list = batch[index].edits.lists + kind;
+    int size = list->size;
+    int added = edits_set(&batch[index].edits, kind, x, y, z, w);
+    batch_edits += list->size - size;
+    if (batch_edits >= DB_BATCH_EDITS) {
+        _db_batch_write();
+    }
+    if (added || db_storage == DB_STORAGE_CHUNKS) {
+        return;
+    }
+    // a row outside of the chunk's block map
+    if (kind == EDIT_BLOCKS) {
+        _db_insert_block(p, q, x, y, z, w);
+    }
+    else if (kind == EDIT_LIGHTS) {
+        _db_insert_light(p, q, x, y, z, w);
+    }
+    else {
+        _db_insert_block_damage(p, q, x, y, z, w);
+    }
+}
+
+
 // Insert a sign on the given block and face from the database
 // Arguments:
 // - p, q: chunk x, z position
@@ -572,21 +1264,32 @@ void db_delete_all_signs() {
 // Arguments:
 // - map: block map destination to load block values into
 // - p, q: chunk x, z position
-// Returns: none
-void db_load_blocks(Map *map, int p, int q) {
-    if (!db_enabled) { return; }
-    mtx_lock(&load_mtx);
-    sqlite3_reset(load_blocks_stmt);
-    sqlite3_bind_int(load_blocks_stmt, 1, p);
-    sqlite3_bind_int(load_blocks_stmt, 2, q);
-    while (sqlite3_step(load_blocks_stmt) == SQLITE_ROW) {
-        int x = sqlite3_column_int(load_blocks_stmt, 0);
-        int y = sqlite3_column_int(load_blocks_stmt, 1);
-        int z = sqlite3_column_int(load_blocks_stmt, 2);
-        int w = sqlite3_column_int(load_blocks_stmt, 3);
-        map_set(map, x, y, z, w);
+// Returns:
+// - number of blocks loaded
+int db_load_blocks(BlockMap *map, int p, int q) {
+    if (!db_enabled) { return 0; }
+    if (db_storage == DB_STORAGE_CHUNKS) {
+        return db_load_chunk(map, NULL, NULL, p, q);
     }
-    mtx_unlock(&load_mtx);
+    int count = 0;
+    DbReader *reader = db_reader_begin(p, q);
+    sqlite3_stmt *stmt = reader->load_blocks_stmt;
+    sqlite3_reset(stmt);
+    sqlite3_bind_int(stmt, 1, p);
+    sqlite3_bind_int(stmt, 2, q);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int x = sqlite3_column_int(stmt, 0);
+        int y = sqlite3_column_int(stmt, 1);
+        int z = sqlite3_column_int(stmt, 2);
+        int w = sqlite3_column_int(stmt, 3);
+        block_map_set(map, x, y, z, w);
+        count++;
+    }
+    if (reader == &shared_reader) {
+        count += db_batch_load(p, q, map, NULL, NULL);
+    }
+    db_reader_end(reader);
+    return count;
 }
 
 
@@ -598,19 +1301,27 @@ void db_load_blocks(Map *map, int p, int q) {
 // Returns: none
 void db_load_damage(Map *map, int p, int q) {
     if (!db_enabled) { return; }
-    mtx_lock(&load_mtx);
-    sqlite3_reset(load_block_damage_stmt);
-    sqlite3_bind_int(load_block_damage_stmt, 1, p);
-    sqlite3_bind_int(load_block_damage_stmt, 2, q);
-    while (sqlite3_step(load_block_damage_stmt) == SQLITE_ROW) {
-        int x = sqlite3_column_int(load_block_damage_stmt, 0);
-        int y = sqlite3_column_int(load_block_damage_stmt, 1);
-        int z = sqlite3_column_int(load_block_damage_stmt, 2);
-        int d = sqlite3_column_int(load_block_damage_stmt, 3);
+    if (db_storage == DB_STORAGE_CHUNKS) {
+        db_load_chunk(NULL, NULL, map, p, q);
+        return;
+    }
+    DbReader *reader = db_reader_begin(p, q);
+    sqlite3_stmt *stmt = reader->load_block_damage_stmt;
+    sqlite3_reset(stmt);
+    sqlite3_bind_int(stmt, 1, p);
+    sqlite3_bind_int(stmt, 2, q);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int x = sqlite3_column_int(stmt, 0);
+        int y = sqlite3_column_int(stmt, 1);
+        int z = sqlite3_column_int(stmt, 2);
+        int d = sqlite3_column_int(stmt, 3);
         if (!d) { continue; }
         map_set(map, x, y, z, d);
     }
-    mtx_unlock(&load_mtx);
+    if (reader == &shared_reader) {
+        db_batch_load(p, q, NULL, NULL, map);
+    }
+    db_reader_end(reader);
 }
 
 
@@ -623,18 +1334,168 @@ void db_load_damage(Map *map, int p, int q) {
 // - modifies lights in given map pointer
 void db_load_lights(Map *map, int p, int q) {
     if (!db_enabled) { return; }
-    mtx_lock(&load_mtx);
-    sqlite3_reset(load_lights_stmt);
-    sqlite3_bind_int(load_lights_stmt, 1, p);
-    sqlite3_bind_int(load_lights_stmt, 2, q);
-    while (sqlite3_step(load_lights_stmt) == SQLITE_ROW) {
-        int x = sqlite3_column_int(load_lights_stmt, 0);
-        int y = sqlite3_column_int(load_lights_stmt, 1);
-        int z = sqlite3_column_int(load_lights_stmt, 2);
-        int w = sqlite3_column_int(load_lights_stmt, 3);
+    if (db_storage == DB_STORAGE_CHUNKS) {
+        db_load_chunk(NULL, map, NULL, p, q);
+        return;
+    }
+    DbReader *reader = db_reader_begin(p, q);
+    sqlite3_stmt *stmt = reader->load_lights_stmt;
+    sqlite3_reset(stmt);
+    sqlite3_bind_int(stmt, 1, p);
+    sqlite3_bind_int(stmt, 2, q);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int x = sqlite3_column_int(stmt, 0);
+        int y = sqlite3_column_int(stmt, 1);
+        int z = sqlite3_column_int(stmt, 2);
+        int w = sqlite3_column_int(stmt, 3);
         map_set(map, x, y, z, w);
     }
-    mtx_unlock(&load_mtx);
+    if (reader == &shared_reader) {
+        db_batch_load(p, q, NULL, map, NULL);
+    }
+    db_reader_end(reader);
+}
+
+
+// Load all of the saved changes of a chunk: its blocks, lights and block
+// damage. With chunk storage this is a single lookup.
+// Arguments:
+// - map: block map to load block values into, may be NULL
+// - lights: light map to load light values into, may be NULL
+// - damage: block damage map to load damage values into, may be NULL
+// - p: chunk x position
+// - q: chunk z position
+// Returns:
+// - number of blocks loaded
+int db_load_chunk(BlockMap *map, Map *lights, Map *damage, int p, int q) {
+    if (!db_enabled) { return 0; }
+    if (db_storage == DB_STORAGE_ROWS) {
+        int count = map ? db_load_blocks(map, p, q) : 0;
+        if (lights) {
+            db_load_lights(lights, p, q);
+        }
+        if (damage) {
+            db_load_damage(damage, p, q);
+        }
+        return count;
+    }
+    ChunkEdits edits;
+    DbReader *reader = db_reader_begin(p, q);
+    _db_read_edits(reader, &edits, p, q);
+    int count = db_apply_edits(&edits, map, lights, damage);
+    if (reader == &shared_reader) {
+        count += db_batch_load(p, q, map, lights, damage);
+    }
+    db_reader_end(reader);
+    edits_free(&edits);
+    return count;
+}
+
+
+// Move the saved changes of a world with row storage into chunk storage.
+// It must be called before anything is queued for the db worker.
+// Arguments: none
+// Returns:
+// - number of chunks moved
+int db_migrate_chunks() {
+    if (!db_enabled || db_storage == DB_STORAGE_CHUNKS) { return 0; }
+    static const char *query =
+        "select p, q from block union select p, q from light "
+        "union select p, q from block_damage;";
+    sqlite3_stmt *stmts[EDIT_KINDS] = {
+        shared_reader.load_blocks_stmt,
+        shared_reader.load_lights_stmt,
+        shared_reader.load_block_damage_stmt
+    };
+    int count = 0;
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int p = sqlite3_column_int(stmt, 0);
+        int q = sqlite3_column_int(stmt, 1);
+        ChunkEdits edits;
+        edits_alloc(&edits, p, q);
+        for (int kind = 0; kind < EDIT_KINDS; kind++) {
+            sqlite3_stmt *load = stmts[kind];
+            sqlite3_reset(load);
+            sqlite3_bind_int(load, 1, p);
+            sqlite3_bind_int(load, 2, q);
+            while (sqlite3_step(load) == SQLITE_ROW) {
+                int x = sqlite3_column_int(load, 0);
+                int y = sqlite3_column_int(load, 1);
+                int z = sqlite3_column_int(load, 2);
+                int w = sqlite3_column_int(load, 3);
+                if (!edits_set(&edits, kind, x, y, z, w)) {
+                    fprintf(stderr, "skipped change at %d, %d, %d "
+                        "outside of chunk %d, %d\n", x, y, z, p, q);
+                }
+            }
+            sqlite3_reset(load);
+        }
+        _db_write_edits(&edits, p, q);
+        edits_free(&edits);
+        count++;
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_exec(db,
+        "delete from block; delete from light; delete from block_damage;",
+        NULL, NULL, NULL);
+    db_storage = DB_STORAGE_CHUNKS;
+    db_save_storage(db_storage);
+    return count;
+}
+
+
+// Load a chunk from its baked data (see bake.h), if it has been baked.
+// The saved edits still need to be loaded afterwards: they may be newer than
+// the baked data.
+// Arguments:
+// - map: empty block map of the chunk to load the blocks into
+// - lights: light map of the chunk to load the light sources into
+// - heightmap: output, heightmap of the baked chunk
+// - p: chunk x position
+// - q: chunk z position
+// - generator: terrain generator of the world
+// Returns:
+// - non-zero if baked data for the world's generator was found and loaded
+int db_load_bake(
+    BlockMap *map, Map *lights, Heightmap *heightmap,
+    int p, int q, int generator)
+{
+    if (!db_enabled) { return 0; }
+    int result = 0;
+    DbReader *reader = db_reader_begin(p, q);
+    sqlite3_stmt *stmt = reader->load_bake_stmt;
+    sqlite3_reset(stmt);
+    sqlite3_bind_int(stmt, 1, p);
+    sqlite3_bind_int(stmt, 2, q);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        const unsigned char *data = sqlite3_column_blob(stmt, 0);
+        int size = sqlite3_column_bytes(stmt, 0);
+        result = unbake_chunk(
+            data, size, generator, map, lights, heightmap);
+    }
+    db_reader_end(reader);
+    return result;
+}
+
+
+// Save the baked data of a chunk, replacing any older baked data.
+// This is not queued for the db worker, and it must not be called by more
+// than one thread at a time.
+// Arguments:
+// - p: chunk x position
+// - q: chunk z position
+// - data: baked data (see bake_chunk())
+// - size: size of data in bytes
+// Returns: none
+void db_save_bake(int p, int q, const unsigned char *data, int size) {
+    if (!db_enabled) { return; }
+    sqlite3_reset(save_bake_stmt);
+    sqlite3_bind_int(save_bake_stmt, 1, p);
+    sqlite3_bind_int(save_bake_stmt, 2, q);
+    sqlite3_bind_blob(save_bake_stmt, 3, data, size, SQLITE_STATIC);
+    sqlite3_step(save_bake_stmt);
 }
 
 
@@ -687,10 +1548,7 @@ int db_get_key(int p, int q) {
 // Returns: none
 void db_set_key(int p, int q, int key) {
     if (!db_enabled) { return; }
-    mtx_lock(&mtx);
     ring_put_key(&ring, p, q, key);
-    cnd_signal(&cnd);
-    mtx_unlock(&mtx);
 }
 
 
@@ -715,10 +1573,11 @@ static void _db_set_key(int p, int q, int key) {
 // Returns: none
 void db_worker_start(char *path) {
     if (!db_enabled) { return; }
-    ring_alloc(&ring, 1024);
-    mtx_init(&mtx, mtx_plain);
+    ring_alloc(&ring, DB_RING_SIZE);
+    commits_queued = 0;
+    commits_done = 0;
+    mtx_init(&pending_mtx, mtx_plain);
     mtx_init(&load_mtx, mtx_plain);
-    cnd_init(&cnd);
     thrd_create(&thrd, db_worker_run, path);
 }
 
@@ -728,14 +1587,10 @@ void db_worker_start(char *path) {
 // Returns: none
 void db_worker_stop() {
     if (!db_enabled) { return; }
-    mtx_lock(&mtx);
     ring_put_exit(&ring);
-    cnd_signal(&cnd);
-    mtx_unlock(&mtx);
     thrd_join(thrd, NULL);
-    cnd_destroy(&cnd);
     mtx_destroy(&load_mtx);
-    mtx_destroy(&mtx);
+    mtx_destroy(&pending_mtx);
     ring_free(&ring);
 }
 
@@ -746,38 +1601,49 @@ void db_worker_stop() {
 // Returns:
 // - 0
 int db_worker_run(void * /*arg*/) {
+    RingEntry entries[DB_WORKER_ENTRIES];
     int running = 1;
     while (running) {
-        RingEntry e;
-        mtx_lock(&mtx);
-        while (!ring_get(&ring, &e)) {
-            cnd_wait(&cnd, &mtx);
-        }
-        mtx_unlock(&mtx);
-        switch (e.type) {
-            case BLOCK:
-                _db_insert_block(e.p, e.q, e.x, e.y, e.z, e.w);
-                _db_insert_block_damage(e.p, e.q, e.x, e.y, e.z, 0);
-                break;
-            case LIGHT:
-                _db_insert_light(e.p, e.q, e.x, e.y, e.z, e.w);
-                break;
-            case KEY:
-                _db_set_key(e.p, e.q, e.key);
-                break;
-            case COMMIT:
-                _db_commit();
-                break;
-            case EXIT:
-                running = 0;
-                break;
-            case BLOCK_DAMAGE:
-                _db_insert_block_damage(e.p, e.q, e.x, e.y, e.z, e.w);
-                break;
-            case BLOCK_DAMAGE_TRIM:
-                _db_block_damage_trim(e.p, e.q);
-                break;
+        int count = ring_wait(&ring, entries, DB_WORKER_ENTRIES);
+        mtx_lock(&load_mtx);
+        for (int i = 0; i < count; i++) {
+            RingEntry *e = entries + i;
+            switch (e->type) {
+                case BLOCK:
+                    _db_batch_set(
+                        e->p, e->q, EDIT_BLOCKS, e->x, e->y, e->z, e->w);
+                    _db_batch_set(
+                        e->p, e->q, EDIT_DAMAGE, e->x, e->y, e->z, 0);
+                    break;
+                case LIGHT:
+                    _db_batch_set(
+                        e->p, e->q, EDIT_LIGHTS, e->x, e->y, e->z, e->w);
+                    break;
+                case KEY:
+                    _db_set_key(e->p, e->q, e->key);
+                    break;
+                case COMMIT:
+                    _db_batch_write();
+                    _db_commit();
+                    db_forget_pending();
+                    break;
+                case EXIT:
+                    _db_batch_write();
+                    running = 0;
+                    break;
+                case BLOCK_DAMAGE:
+                    _db_batch_set(
+                        e->p, e->q, EDIT_DAMAGE, e->x, e->y, e->z, e->w);
+                    break;
+                case BLOCK_DAMAGE_TRIM:
+                    // chunk storage does not keep damage of 0
+                    if (db_storage == DB_STORAGE_ROWS) {
+                        _db_block_damage_trim(e->p, e->q);
+                    }
+                    break;
+            }
         }
+        mtx_unlock(&load_mtx);
     }
     return 0;
 }
@@ -2,9 +2,16 @@
 #define _db_h_
 
 
+#include "blockmap.h"
+#include "heightmap.h"
 #include "map.h"
+#include "ring.h"
 #include "sign.h"
 
+// How the changes of a world are stored (see db.c)
+#define DB_STORAGE_ROWS 0
+#define DB_STORAGE_CHUNKS 1
+
 
 int db_auth_get(
         char *username,
@@ -54,6 +61,8 @@ int db_get_key(
 int db_init(
         char *path);
 
+int db_migrate_chunks();
+
 void db_insert_block(
         int p,
         int q,
@@ -87,8 +96,23 @@ void db_insert_sign(
         int face,
         const char *text);
 
-void db_load_blocks(
-        Map *map,
+int db_load_bake(
+        BlockMap *map,
+        Map *lights,
+        Heightmap *heightmap,
+        int p,
+        int q,
+        int generator);
+
+int db_load_chunk(
+        BlockMap *map,
+        Map *lights,
+        Map *damage,
+        int p,
+        int q);
+
+int db_load_blocks(
+        BlockMap *map,
         int p,
         int q);
 
@@ -107,6 +131,14 @@ void db_load_signs(
         int p,
         int q);
 
+int db_is_new_world();
+
+int db_load_generator(
+        int *generator);
+
+int db_load_storage(
+        int *storage);
+
 int db_load_state(
         float *x,
         float *y,
@@ -115,6 +147,21 @@ int db_load_state(
         float *ry,
         int *flying);
 
+void db_queue_stats(
+        RingStats *stats);
+
+void db_save_bake(
+        int p,
+        int q,
+        const unsigned char *data,
+        int size);
+
+void db_save_generator(
+        int generator);
+
+void db_save_storage(
+        int storage);
+
 void db_save_state(
         float x,
         float y,
@@ -0,0 +1,311 @@
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "edits.h"
+
+// This file contains the saved changes of a chunk and their stored format.
+// The edits of a chunk are laid out as:
+// - version (EDITS_VERSION), 1 byte
+// - for each kind (EDIT_BLOCKS, EDIT_LIGHTS, EDIT_DAMAGE): the number of
+//   runs, then for each run of consecutive indices with the same value the
+//   gap since the end of the previous run, the length of the run and the
+//   value (zigzag encoded)
+// All numbers after the version are unsigned LEB128 varints, so a chunk with
+// a few edits takes a few bytes and a built-up area compresses to its runs.
+
+#define EDITS_VOLUME (BLOCK_MAP_WIDTH * BLOCK_MAP_WIDTH * BLOCK_MAP_HEIGHT)
+
+
+// Write a varint, or only count its bytes if out is NULL
+static int put_varint(unsigned char *out, unsigned int value) {
+    int size = 0;
+    do {
+        unsigned char byte = value & 0x7f;
+        value >>= 7;
+        if (out) {
+            out[size] = byte | (value ? 0x80 : 0);
+        }
+        size++;
+    } while (value);
+    return size;
+}
+
+
+// Read a varint of at most 5 bytes
+// Returns:
+// - number of bytes read, or 0 if the data ends before the varint does
+static int get_varint(const unsigned char *in, const unsigned char *end,
+        unsigned int *value)
+{
+    unsigned int result = 0;
+    for (int i = 0; i < 5 && in + i < end; i++) {
+        result |= (unsigned int)(in[i] & 0x7f) << (i * 7);
+        if (!(in[i] & 0x80)) {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+
+static unsigned int zigzag(int w) {
+    return ((unsigned int)w << 1) ^ (unsigned int)(w >> 31);
+}
+
+
+static int unzigzag(unsigned int value) {
+    return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+
+// Add an edit at the end of a list
+static void list_append(EditList *list, int index, int w) {
+    if (list->size == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->data = (Edit *)realloc(
+            list->data, sizeof(Edit) * list->capacity);
+    }
+    list->data[list->size].index = index;
+    list->data[list->size].w = w;
+    list->size++;
+}
+
+
+// Initialize the edits of a chunk with no changes
+// Arguments:
+// - edits
+// - p: chunk x position
+// - q: chunk z position
+// Returns: none
+void edits_alloc(
+        ChunkEdits *edits,
+        int p,
+        int q)
+{
+    edits->dx = p * CHUNK_SIZE - 1;
+    edits->dy = 0;
+    edits->dz = q * CHUNK_SIZE - 1;
+    memset(edits->lists, 0, sizeof(edits->lists));
+}
+
+
+// Free the memory of the edits of a chunk (but not the edits pointer)
+// Arguments:
+// - edits
+// Returns: none
+void edits_free(
+        ChunkEdits *edits)
+{
+    for (int i = 0; i < EDIT_KINDS; i++) {
+        free(edits->lists[i].data);
+    }
+    memset(edits->lists, 0, sizeof(edits->lists));
+}
+
+
+// Set a change of a chunk, replacing an older change at the same position.
+// Damage of 0 is kept until edits_trim(), so that the edits can also hold
+// changes that are still to be applied to the stored edits.
+// Arguments:
+// - edits
+// - kind: EDIT_BLOCKS, EDIT_LIGHTS or EDIT_DAMAGE
+// - x, y, z: block position
+// - w: new value
+// Returns:
+// - zero if the position is outside of the chunk's block map, non-zero
+//   otherwise
+int edits_set(
+        ChunkEdits *edits,
+        int kind,
+        int x,
+        int y,
+        int z,
+        int w)
+{
+    x -= edits->dx;
+    y -= edits->dy;
+    z -= edits->dz;
+    if (x < 0 || y < 0 || z < 0 || x >= BLOCK_MAP_WIDTH ||
+        y >= BLOCK_MAP_HEIGHT || z >= BLOCK_MAP_WIDTH)
+    {
+        return 0;
+    }
+    int index = EDITS_INDEX(x, y, z);
+    EditList *list = edits->lists + kind;
+    int lo = 0;
+    int hi = list->size;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (list->data[mid].index < index) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    if (lo < list->size && list->data[lo].index == index) {
+        list->data[lo].w = w;
+        return 1;
+    }
+    list_append(list, 0, 0);
+    memmove(list->data + lo + 1, list->data + lo,
+        sizeof(Edit) * (list->size - 1 - lo));
+    list->data[lo].index = index;
+    list->data[lo].w = w;
+    return 1;
+}
+
+
+// Remove the damage edits of 0, which are not stored. The other kinds keep 0
+// values because they undo what the generated world has there.
+// Arguments:
+// - edits
+// Returns: none
+void edits_trim(
+        ChunkEdits *edits)
+{
+    EditList *list = edits->lists + EDIT_DAMAGE;
+    int size = 0;
+    for (int i = 0; i < list->size; i++) {
+        if (list->data[i].w) {
+            list->data[size++] = list->data[i];
+        }
+    }
+    list->size = size;
+}
+
+
+// Get the block position of an edit index
+// Arguments:
+// - edits
+// - index: position index (EDITS_INDEX())
+// - x, y, z: output block position
+// Returns: none
+void edits_position(
+        const ChunkEdits *edits,
+        int index,
+        int *x,
+        int *y,
+        int *z)
+{
+    *z = index % BLOCK_MAP_WIDTH + edits->dz;
+    index /= BLOCK_MAP_WIDTH;
+    *x = index % BLOCK_MAP_WIDTH + edits->dx;
+    *y = index / BLOCK_MAP_WIDTH + edits->dy;
+}
+
+
+// Write the edits of a chunk in the stored format
+// Arguments:
+// - edits
+// - data: output, or NULL to only get the size
+// Returns:
+// - size of the data in bytes
+int edits_write(
+        const ChunkEdits *edits,
+        unsigned char *data)
+{
+    int size = 0;
+    if (data) {
+        data[size] = EDITS_VERSION;
+    }
+    size++;
+    for (int kind = 0; kind < EDIT_KINDS; kind++) {
+        const EditList *list = edits->lists + kind;
+        int runs = 0;
+        for (int i = 0; i < list->size; i++) {
+            runs += i == 0 ||
+                list->data[i].index != list->data[i - 1].index + 1 ||
+                list->data[i].w != list->data[i - 1].w;
+        }
+        size += put_varint(data ? data + size : NULL, runs);
+        int end = 0;
+        for (int i = 0; i < list->size;) {
+            int j = i + 1;
+            while (j < list->size &&
+                list->data[j].index == list->data[j - 1].index + 1 &&
+                list->data[j].w == list->data[i].w)
+            {
+                j++;
+            }
+            int index = list->data[i].index;
+            size += put_varint(data ? data + size : NULL, index - end);
+            size += put_varint(data ? data + size : NULL, j - i);
+            size += put_varint(data ? data + size : NULL,
+                zigzag(list->data[i].w));
+            end = index + j - i;
+            i = j;
+        }
+    }
+    return size;
+}
+
+
+// Read the runs of one kind of edits
+// Returns:
+// - number of bytes read, or 0 if the data is not valid
+static int read_list(EditList *list, const unsigned char *data,
+        const unsigned char *end)
+{
+    const unsigned char *in = data;
+    unsigned int runs;
+    int n = get_varint(in, end, &runs);
+    if (!n) {
+        return 0;
+    }
+    in += n;
+    unsigned int index = 0;
+    for (unsigned int i = 0; i < runs; i++) {
+        unsigned int values[3];
+        for (int j = 0; j < 3; j++) {
+            n = get_varint(in, end, values + j);
+            if (!n) {
+                return 0;
+            }
+            in += n;
+        }
+        unsigned int gap = values[0];
+        unsigned int length = values[1];
+        if (!length || gap > EDITS_VOLUME || length > EDITS_VOLUME ||
+            index + gap + length > EDITS_VOLUME)
+        {
+            return 0;
+        }
+        index += gap;
+        int w = unzigzag(values[2]);
+        for (unsigned int k = 0; k < length; k++) {
+            list_append(list, index++, w);
+        }
+    }
+    return in - data;
+}
+
+
+// Load the edits of a chunk from edits_write() data
+// Arguments:
+// - edits: edits with no changes (see edits_alloc())
+// - data: stored edits
+// - size: size of data in bytes
+// Returns:
+// - number of bytes read, or -1 if the data is not valid (the edits are
+//   left empty then)
+int edits_read(
+        ChunkEdits *edits,
+        const unsigned char *data,
+        int size)
+{
+    if (size < 1 || data[0] != EDITS_VERSION) {
+        return -1;
+    }
+    int offset = 1;
+    for (int kind = 0; kind < EDIT_KINDS; kind++) {
+        int n = read_list(edits->lists + kind, data + offset, data + size);
+        if (!n) {
+            edits_free(edits);
+            return -1;
+        }
+        offset += n;
+    }
+    return offset;
+}
@@ -0,0 +1,78 @@
+#ifndef _edits_h_
+#define _edits_h_
+
+#include "blockmap.h"
+
+// Version of the chunk edits format, data of other versions is not read
+#define EDITS_VERSION 1
+
+// Kinds of saved changes of a chunk
+#define EDIT_BLOCKS 0
+#define EDIT_LIGHTS 1
+#define EDIT_DAMAGE 2
+#define EDIT_KINDS 3
+
+// Index of a position in the area of a chunk's block map, relative to the
+// map's origin (the same order as BLOCK_SECTION_INDEX())
+#define EDITS_INDEX(x, y, z) \
+    (((y) * BLOCK_MAP_WIDTH + (x)) * BLOCK_MAP_WIDTH + (z))
+
+// One saved change: position index (EDITS_INDEX()) and value
+typedef struct {
+    int index;
+    int w;
+} Edit;
+
+// Changes of one kind, sorted by index
+typedef struct {
+    int size;
+    int capacity;
+    Edit *data;
+} EditList;
+
+// The changes saved for a chunk (placed blocks, light sources and block
+// damage), which are stored together as one blob (see edits_write()).
+// - dx, dy, dz: origin of the chunk's block map
+typedef struct {
+    int dx;
+    int dy;
+    int dz;
+    EditList lists[EDIT_KINDS];
+} ChunkEdits;
+
+void edits_alloc(
+        ChunkEdits *edits,
+        int p,
+        int q);
+
+void edits_free(
+        ChunkEdits *edits);
+
+int edits_set(
+        ChunkEdits *edits,
+        int kind,
+        int x,
+        int y,
+        int z,
+        int w);
+
+void edits_trim(
+        ChunkEdits *edits);
+
+void edits_position(
+        const ChunkEdits *edits,
+        int index,
+        int *x,
+        int *y,
+        int *z);
+
+int edits_write(
+        const ChunkEdits *edits,
+        unsigned char *data);
+
+int edits_read(
+        ChunkEdits *edits,
+        const unsigned char *data,
+        int size);
+
+#endif
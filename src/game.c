@@ -4,10 +4,13 @@
 #include "cube.h"
 #include "db.h"
 #include "game.h"
+#include "heightmap.h"
 #include "hitbox.h"
 #include "item.h"
+#include "blockmap.h"
 #include "map.h"
 #include "matrix.h"
+#include "mesh.h"
 #include "noise.h"
 #include "player.h"
 #include "sign.h"
@@ -471,14 +474,44 @@ void draw_lines(
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-// Draw a game chunk (of blocks)
+// Draw the block faces of a mesh section of a game chunk. The quad index
+// buffer must be bound (see bind_quad_indices()).
 // Arguments:
+// - attrib: chunk shader attributes
+// - mesh: chunk mesh section to draw
 // Returns: none
-void draw_chunk(
+void draw_chunk_mesh(
         Attrib *attrib,
-        Chunk *chunk)
+        ChunkMesh *mesh)
 {
-    draw_triangles_3d_ao(attrib, chunk->buffer, chunk->faces * 6);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->buffer);
+    glEnableVertexAttribArray(attrib->position);
+    glEnableVertexAttribArray(attrib->uv);
+    glVertexAttribPointer(attrib->position, 4, GL_UNSIGNED_BYTE, GL_FALSE,
+            sizeof(ChunkVertex), 0);
+    glVertexAttribPointer(attrib->uv, 4, GL_UNSIGNED_BYTE, GL_FALSE,
+            sizeof(ChunkVertex), (GLvoid *)(sizeof(GLubyte) * 4));
+    glDrawElements(GL_TRIANGLES, mesh->faces * 6, GL_UNSIGNED_INT, 0);
+    glDisableVertexAttribArray(attrib->position);
+    glDisableVertexAttribArray(attrib->uv);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Bind the index buffer for drawing chunk meshes, making it larger first if
+// it can not draw the given number of quads
+// Arguments:
+// - quads: number of quads to draw
+// Returns: none
+void bind_quad_indices(
+        Model *g,
+        int quads)
+{
+    if (quads > g->quad_capacity) {
+        del_buffer(g->quad_buffer);
+        g->quad_capacity = MAX(quads, g->quad_capacity * 2);
+        g->quad_buffer = gen_quad_indices(g->quad_capacity);
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g->quad_buffer);
 }
 
 // Draw a block (item), which can be a plant shape or a cube shape
@@ -690,6 +723,68 @@ player_crosshair(
     return result;
 }
 
+// Get the slot of a chunk position in the chunk index.
+// The chunk index is a hash table with linear probing: each slot holds the
+// index of a chunk in g->chunks plus 1, or 0 if it is empty.
+// Arguments:
+// - p: chunk x
+// - q: chunk z
+// Returns:
+// - slot of the chunk, or the empty slot where it would be added
+int chunk_index_slot(
+        Model *g,
+        int p,
+        int q)
+{
+    unsigned int mask = CHUNK_INDEX_SIZE - 1;
+    unsigned int slot = ((unsigned int)p * 73856093u) ^
+        ((unsigned int)q * 19349663u);
+    slot = (slot ^ (slot >> 15)) & mask;
+    while (g->chunk_index[slot]) {
+        Chunk *chunk = g->chunks + g->chunk_index[slot] - 1;
+        if (chunk->p == p && chunk->q == q) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Add a chunk to the chunk index
+// Arguments:
+// - chunk: chunk in g->chunks, with its position set
+// Returns: none
+void chunk_index_add(
+        Model *g,
+        Chunk *chunk)
+{
+    int slot = chunk_index_slot(g, chunk->p, chunk->q);
+    g->chunk_index[slot] = chunk - g->chunks + 1;
+}
+
+// Remove a chunk from the chunk index. The entries that follow it are added
+// again, so that no lookup stops at the emptied slot too early.
+// Arguments:
+// - chunk: chunk in the index
+// Returns: none
+void chunk_index_remove(
+        Model *g,
+        Chunk *chunk)
+{
+    unsigned int mask = CHUNK_INDEX_SIZE - 1;
+    unsigned int slot = chunk_index_slot(g, chunk->p, chunk->q);
+    g->chunk_index[slot] = 0;
+    while (1) {
+        slot = (slot + 1) & mask;
+        int index = g->chunk_index[slot];
+        if (!index) {
+            return;
+        }
+        g->chunk_index[slot] = 0;
+        chunk_index_add(g, g->chunks + index - 1);
+    }
+}
+
 // Try to find a chunk with at specific chunk coordinates
 // Arguments:
 // - p: chunk x
@@ -702,13 +797,11 @@ find_chunk(
         int p,
         int q)
 {
-    for (int i = 0; i < g->chunk_count; i++) {
-        Chunk *chunk = g->chunks + i;
-        if (chunk->p == p && chunk->q == q) {
-            return chunk;
-        }
+    int index = g->chunk_index[chunk_index_slot(g, p, q)];
+    if (!index) {
+        return NULL;
     }
-    return NULL;
+    return g->chunks + index - 1;
 }
 
 // Get the "distance" of a chunk from the given chunk coordinates.
@@ -787,7 +880,8 @@ int chunk_visible(
     return 1;
 }
 
-// Find the highest y position of a block at a given (x,z) position.
+// Find the highest y position of an obstacle at a given (x,z) position, from
+// the heightmap of its chunk.
 // Arguments:
 // - x
 // - z
@@ -805,12 +899,7 @@ int highest_block(
     int q = chunked(z);
     Chunk *chunk = find_chunk(g, p, q);
     if (chunk) {
-        Map *map = &chunk->map;
-        MAP_FOR_EACH(map, ex, ey, ez, ew) {
-            if (is_obstacle(ew) && ex == nx && ez == nz) {
-                result = MAX(result, ey);
-            }
-        } END_MAP_FOR_EACH;
+        result = heightmap_obstacle(&chunk->heightmap, nx, nz);
     }
     return result;
 }
@@ -834,7 +923,7 @@ int highest_block(
 // - the block type that was hit, returns 0 if there was no block found
 // - writes hit output to hx, hy, and hz
 int _hit_test(
-        Map *map,
+        BlockMap *map,
         float max_distance,
         int previous,
         float x,
@@ -856,7 +945,7 @@ int _hit_test(
         int ny = roundf(y);
         int nz = roundf(z);
         if (nx != px || ny != py || nz != pz) {
-            int hw = map_get(map, nx, ny, nz);
+            int hw = block_map_get(map, nx, ny, nz);
             if (hw > 0) {
                 if (previous) {
                     *hx = px; *hy = py; *hz = pz;
@@ -907,21 +996,24 @@ hit_test(
     int q = chunked(z);
     float vx, vy, vz;
     get_sight_vector(rx, ry, &vx, &vy, &vz);
-    for (int i = 0; i < g->chunk_count; i++) {
-        Chunk *chunk = g->chunks + i;
-        if (chunk_distance(chunk, p, q) > 1+chunked(r)) {
-            continue;
-        }
-        int hx, hy, hz;
-        int hw = _hit_test(&chunk->map, r, previous,
-                x, y, z, vx, vy, vz, &hx, &hy, &hz);
-        if (hw > 0) {
-            float d = sqrtf(
-                    powf(hx - x, 2) + powf(hy - y, 2) + powf(hz - z, 2));
-            if (best == 0 || d < best) {
-                best = d;
-                *bx = hx; *by = hy; *bz = hz;
-                result = hw;
+    int n = 1 + chunked(r);
+    for (int dp = -n; dp <= n; dp++) {
+        for (int dq = -n; dq <= n; dq++) {
+            Chunk *chunk = find_chunk(g, p + dp, q + dq);
+            if (!chunk) {
+                continue;
+            }
+            int hx, hy, hz;
+            int hw = _hit_test(&chunk->map, r, previous,
+                    x, y, z, vx, vy, vz, &hx, &hy, &hz);
+            if (hw > 0) {
+                float d = sqrtf(
+                        powf(hx - x, 2) + powf(hy - y, 2) + powf(hz - z, 2));
+                if (best == 0 || d < best) {
+                    best = d;
+                    *bx = hx; *by = hy; *bz = hz;
+                    result = hw;
+                }
             }
         }
     }
@@ -1108,365 +1200,390 @@ void gen_sign_buffer(
 }
 
 
-// Predicate function for whether a given chunk has any block light values
+// Mark the mesh sections that hold any of the blocks in a box as dirty
 // Arguments:
-// - chunk: the chunk to check
-// Returns:
-// - non-zero if the chunk has lights
-int has_lights(
+// - x0, y0, z0: minimum corner of the box
+// - x1, y1, z1: maximum corner of the box
+// Returns: none
+void dirty_blocks(
         Model *g,
-        Chunk *chunk)
+        int x0,
+        int y0,
+        int z0,
+        int x1,
+        int y1,
+        int z1)
 {
-    if (!SHOW_LIGHTS) {
-        return 0;
+    y0 = MAX(y0, 0);
+    y1 = MIN(y1, BLOCK_MAP_HEIGHT - 1);
+    if (y0 > y1) {
+        return;
     }
-    for (int dp = -1; dp <= 1; dp++) {
-        for (int dq = -1; dq <= 1; dq++) {
-            Chunk *other = chunk;
-            if (dp || dq) {
-                other = find_chunk(g, chunk->p + dp, chunk->q + dq);
-            }
-            if (!other) {
-                continue;
-            }
-            Map *map = &other->lights;
-            if (map->size) {
-                return 1;
+    int sections = 0;
+    for (int i = y0 / CHUNK_MESH_HEIGHT; i <= y1 / CHUNK_MESH_HEIGHT; i++) {
+        sections |= 1 << i;
+    }
+    for (int p = chunked(x0); p <= chunked(x1); p++) {
+        for (int q = chunked(z0); q <= chunked(z1); q++) {
+            Chunk *chunk = find_chunk(g, p, q);
+            if (chunk) {
+                chunk->dirty |= sections;
             }
         }
     }
-    return 0;
 }
 
 
-// Mark a chunk as dirty and also potentially mark the neighboring chunks
+// Mark the mesh sections that a change to the block at (x, y, z) can change
+// as dirty: the faces and ambient occlusion of the blocks around it and the
+// shading of the blocks up to 8 below it. Changes to light levels are marked
+// by the light engine (see light_set_level()).
+// Arguments:
+// - x, y, z: block position
+// Returns: none
+void dirty_block(
+        Model *g,
+        int x,
+        int y,
+        int z)
+{
+    dirty_blocks(g, x - 1, y - 8, z - 1, x + 1, y + 1, z + 1);
+}
+
+
+// Mark all of a chunk's mesh sections as dirty
 // Arguments:
 // - chunk: chunk to mark as dirty
 void dirty_chunk(
-        Model *g,
         Chunk *chunk)
 {
-    chunk->dirty = 1;
-    if (has_lights(g, chunk)) {
-        for (int dp = -1; dp <= 1; dp++) {
-            for (int dq = -1; dq <= 1; dq++) {
-                Chunk *other = find_chunk(g, chunk->p + dp, chunk->q + dq);
-                if (other) {
-                    other->dirty = 1;
-                }
-            }
-        }
-    }
+    chunk->dirty = CHUNK_DIRTY_ALL | CHUNK_DIRTY_SIGNS;
 }
 
 
+// Find the loaded chunk that holds a block, for the light engine.
+// Consecutive blocks are nearly always in the same chunk, so the last chunk
+// found is remembered until the light engine is done (see update_light()).
 // Arguments:
-// - neighbors
-// - lights
-// - shades
-// - ao
-// - light
-// Returns: none
-void occlusion(
-        char neighbors[27],
-        char lights[27],
-        float shades[27],
-        float ao[6][4],
-        float light[6][4])
+// - x, z: block position
+// Returns:
+// - chunk, or NULL if the chunk is missing or not loaded yet
+Chunk *find_light_chunk(
+        Model *g,
+        int x,
+        int z)
 {
-    static const int lookup3[6][4][3] = {
-        {{0, 1, 3}, {2, 1, 5}, {6, 3, 7}, {8, 5, 7}},
-        {{18, 19, 21}, {20, 19, 23}, {24, 21, 25}, {26, 23, 25}},
-        {{6, 7, 15}, {8, 7, 17}, {24, 15, 25}, {26, 17, 25}},
-        {{0, 1, 9}, {2, 1, 11}, {18, 9, 19}, {20, 11, 19}},
-        {{0, 3, 9}, {6, 3, 15}, {18, 9, 21}, {24, 15, 21}},
-        {{2, 5, 11}, {8, 5, 17}, {20, 11, 23}, {26, 17, 23}}
-    };
-    static const int lookup4[6][4][4] = {
-        {{0, 1, 3, 4}, {1, 2, 4, 5}, {3, 4, 6, 7}, {4, 5, 7, 8}},
-        {{18, 19, 21, 22}, {19, 20, 22, 23}, {21, 22, 24, 25}, {22, 23, 25, 26}},
-        {{6, 7, 15, 16}, {7, 8, 16, 17}, {15, 16, 24, 25}, {16, 17, 25, 26}},
-        {{0, 1, 9, 10}, {1, 2, 10, 11}, {9, 10, 18, 19}, {10, 11, 19, 20}},
-        {{0, 3, 9, 12}, {3, 6, 12, 15}, {9, 12, 18, 21}, {12, 15, 21, 24}},
-        {{2, 5, 11, 14}, {5, 8, 14, 17}, {11, 14, 20, 23}, {14, 17, 23, 26}}
-    };
-    static const float curve[4] = {0.0, 0.25, 0.5, 0.75};
-    for (int i = 0; i < 6; i++) {
-        for (int j = 0; j < 4; j++) {
-            int corner = neighbors[lookup3[i][j][0]];
-            int side1 = neighbors[lookup3[i][j][1]];
-            int side2 = neighbors[lookup3[i][j][2]];
-            int value = side1 && side2 ? 3 : corner + side1 + side2;
-            float shade_sum = 0;
-            float light_sum = 0;
-            int is_light = lights[13] == 15;
-            for (int k = 0; k < 4; k++) {
-                shade_sum += shades[lookup4[i][j][k]];
-                light_sum += lights[lookup4[i][j][k]];
-            }
-            if (is_light) {
-                light_sum = 15 * 4 * 10;
-            }
-            float total = curve[value] + shade_sum / 4.0;
-            ao[i][j] = MIN(total, 1.0);
-            light[i][j] = light_sum / 15.0 / 4.0;
-        }
+    int p = chunked(x);
+    int q = chunked(z);
+    Chunk *chunk = g->light_chunk;
+    if (!chunk || chunk->p != p || chunk->q != q) {
+        chunk = find_chunk(g, p, q);
+        g->light_chunk = chunk;
+    }
+    if (chunk && !chunk->loaded) {
+        return 0;
     }
+    return chunk;
 }
 
 
-#define XZ_SIZE (CHUNK_SIZE * 3 + 2)
-#define XZ_LO (CHUNK_SIZE)
-#define XZ_HI (CHUNK_SIZE * 2 + 1)
-#define Y_SIZE 258
-#define XYZ(x, y, z) ((y) * XZ_SIZE * XZ_SIZE + (x) * XZ_SIZE + (z))
-#define XZ(x, z) ((x) * XZ_SIZE + (z))
+// LightWorld callback: get the light level of a block
+int light_get_level(
+        void *arg,
+        int x,
+        int y,
+        int z)
+{
+    if (y < 0 || y >= BLOCK_MAP_HEIGHT) {
+        return -1;
+    }
+    Chunk *chunk = find_light_chunk((Model *)arg, x, z);
+    if (!chunk) {
+        return -1;
+    }
+    return block_map_get(&chunk->light_levels, x, y, z);
+}
 
 
-// Arguments:
-// - opaque
-// - light
-// - x
-// - y
-// - z
-// - w
-// - force
-// Returns: none
-void light_fill(
-        char *opaque,
-        char *light,
+// LightWorld callback: set the light level of a block and mark the mesh
+// sections that show it as dirty
+void light_set_level(
+        void *arg,
         int x,
         int y,
         int z,
-        int w,
-        int force)
+        int w)
 {
-    if (x + w < XZ_LO || z + w < XZ_LO) {
+    Model *g = (Model *)arg;
+    Chunk *chunk = find_light_chunk(g, x, z);
+    if (!chunk) {
         return;
     }
-    if (x - w > XZ_HI || z - w > XZ_HI) {
+    block_map_set(&chunk->light_levels, x, y, z, w);
+    // faces are lit by the blocks next to them
+    int lx = x - chunk->p * CHUNK_SIZE;
+    int lz = z - chunk->q * CHUNK_SIZE;
+    if (lx == 0 || lz == 0 || lx == CHUNK_SIZE - 1 || lz == CHUNK_SIZE - 1) {
+        dirty_blocks(g, x - 1, y - 1, z - 1, x + 1, y + 1, z + 1);
         return;
     }
-    if (y < 0 || y >= Y_SIZE) {
-        return;
+    int y0 = MAX(y - 1, 0) / CHUNK_MESH_HEIGHT;
+    int y1 = MIN(y + 1, BLOCK_MAP_HEIGHT - 1) / CHUNK_MESH_HEIGHT;
+    for (int i = y0; i <= y1; i++) {
+        chunk->dirty |= 1 << i;
     }
-    if (light[XYZ(x, y, z)] >= w) {
-        return;
+}
+
+
+// LightWorld callback: get the intensity of the light source at a block
+int light_get_source(
+        void *arg,
+        int x,
+        int y,
+        int z)
+{
+    Chunk *chunk = find_light_chunk((Model *)arg, x, z);
+    if (!chunk || !SHOW_LIGHTS) {
+        return 0;
     }
-    if (!force && opaque[XYZ(x, y, z)]) {
-        return;
+    return map_get(&chunk->lights, x, y, z);
+}
+
+
+// LightWorld callback: check if light does not pass into a block. The blocks
+// of chunks that are not loaded count as transparent.
+int light_is_opaque(
+        void *arg,
+        int x,
+        int y,
+        int z)
+{
+    Chunk *chunk = find_light_chunk((Model *)arg, x, z);
+    if (!chunk) {
+        return 0;
     }
-    light[XYZ(x, y, z)] = w--;
-    light_fill(opaque, light, x - 1, y, z, w, 0);
-    light_fill(opaque, light, x + 1, y, z, w, 0);
-    light_fill(opaque, light, x, y - 1, z, w, 0);
-    light_fill(opaque, light, x, y + 1, z, w, 0);
-    light_fill(opaque, light, x, y, z - 1, w, 0);
-    light_fill(opaque, light, x, y, z + 1, w, 0);
+    return !is_transparent(block_map_get(&chunk->map, x, y, z));
+}
+
+
+// Set up the light engine for the model's chunks
+// Arguments: none
+// Returns: none
+void init_light(
+        Model *g)
+{
+    LightWorld world;
+    world.arg = g;
+    world.get_level = light_get_level;
+    world.set_level = light_set_level;
+    world.get_source = light_get_source;
+    world.is_opaque = light_is_opaque;
+    light_engine_init(&g->light, world);
+    g->light_chunk = 0;
+}
+
+
+// Apply the queued light changes
+// Arguments: none
+// Returns: none
+void update_light(
+        Model *g)
+{
+    // chunks may have moved in g->chunks since the last update
+    g->light_chunk = 0;
+    light_update(&g->light);
 }
 
 
+// Find the terrain generator of the current world. Servers generate the
+// classic terrain, and worlds saved before there was a choice of generator
+// keep it too, so that their new chunks match the saved ones. A new offline
+// world uses WORLD_GENERATOR and remembers it.
 // Arguments:
-// - item
+// - g: model with the database of the world open
 // Returns: none
-void compute_chunk(
-        WorkerItem *item)
+void load_world_generator(
+        Model *g)
 {
-    char *opaque = (char *)calloc(XZ_SIZE * XZ_SIZE * Y_SIZE, sizeof(char));
-    char *light = (char *)calloc(XZ_SIZE * XZ_SIZE * Y_SIZE, sizeof(char));
-    char *highest = (char *)calloc(XZ_SIZE * XZ_SIZE, sizeof(char));
+    int generator = WORLD_GEN_CLASSIC;
+    if (g->mode == MODE_ONLINE) {
+        g->generator = generator;
+        return;
+    }
+    if (!db_load_generator(&generator)) {
+        generator = db_is_new_world() ? WORLD_GENERATOR : WORLD_GEN_CLASSIC;
+        db_save_generator(generator);
+    }
+    g->generator = generator;
+}
 
-    int ox = item->p * CHUNK_SIZE - CHUNK_SIZE - 1;
-    int oy = -1;
-    int oz = item->q * CHUNK_SIZE - CHUNK_SIZE - 1;
 
-    // check for lights
-    int has_light = 0;
+// Light a chunk that was just loaded: spread the light of its own sources and
+// the light of the neighboring chunks into it.
+// Arguments:
+// - chunk: loaded chunk
+// Returns: none
+void load_chunk_light(
+        Model *g,
+        Chunk *chunk)
+{
+    chunk->loaded = 1;
+    g->light_chunk = 0;
     if (SHOW_LIGHTS) {
-        for (int a = 0; a < 3; a++) {
-            for (int b = 0; b < 3; b++) {
-                Map *map = item->light_maps[a][b];
-                if (map && map->size) {
-                    has_light = 1;
-                }
-            }
-        }
+        Map *map = &chunk->lights;
+        MAP_FOR_EACH(map, ex, ey, ez, ew) {
+            light_add(&g->light, ex, ey, ez, ew);
+        } END_MAP_FOR_EACH;
     }
-
-    // populate opaque array
-    for (int a = 0; a < 3; a++) {
-        for (int b = 0; b < 3; b++) {
-            Map *map = item->block_maps[a][b];
-            if (!map) {
-                continue;
-            }
-            MAP_FOR_EACH(map, ex, ey, ez, ew) {
-                int x = ex - ox;
-                int y = ey - oy;
-                int z = ez - oz;
-                int w = ew;
-                // TODO: this should be unnecessary
-                if (x < 0 || y < 0 || z < 0) {
-                    continue;
-                }
-                if (x >= XZ_SIZE || y >= Y_SIZE || z >= XZ_SIZE) {
-                    continue;
-                }
-                // END TODO
-                opaque[XYZ(x, y, z)] = !is_transparent(w);
-                if (opaque[XYZ(x, y, z)]) {
-                    highest[XZ(x, z)] = MAX(highest[XZ(x, z)], y);
-                }
-            } END_MAP_FOR_EACH;
+    int x0 = chunk->p * CHUNK_SIZE;
+    int z0 = chunk->q * CHUNK_SIZE;
+    int x1 = x0 + CHUNK_SIZE - 1;
+    int z1 = z0 + CHUNK_SIZE - 1;
+    for (int i = 0; i < 4; i++) {
+        int dp = i == 0 ? -1 : i == 1 ? 1 : 0;
+        int dq = i == 2 ? -1 : i == 3 ? 1 : 0;
+        Chunk *other = find_chunk(g, chunk->p + dp, chunk->q + dq);
+        if (!other || !other->loaded) {
+            continue;
         }
-    }
-
-    // flood fill light intensities
-    if (has_light) {
-        for (int a = 0; a < 3; a++) {
-            for (int b = 0; b < 3; b++) {
-                Map *map = item->light_maps[a][b];
-                if (!map) {
-                    continue;
-                }
-                MAP_FOR_EACH(map, ex, ey, ez, ew) {
-                    int x = ex - ox;
-                    int y = ey - oy;
-                    int z = ez - oz;
-                    light_fill(opaque, light, x, y, z, ew, 1);
-                } END_MAP_FOR_EACH;
+        BlockMap *map = &other->light_levels;
+        BLOCK_MAP_FOR_EACH(map, ex, ey, ez, ew) {
+            if ((dp && ex == (dp < 0 ? x0 - 1 : x1 + 1)) ||
+                (dq && ez == (dq < 0 ? z0 - 1 : z1 + 1)))
+            {
+                light_spread(&g->light, ex, ey, ez);
             }
-        }
+        } END_BLOCK_MAP_FOR_EACH;
     }
+    update_light(g);
+}
 
-    Map *map = item->block_maps[1][1];
 
-    // count exposed faces
-    int miny = 256;
-    int maxy = 0;
-    int faces = 0;
-    MAP_FOR_EACH(map, ex, ey, ez, ew) {
-        if (ew <= 0) {
-            continue;
-        }
-        int x = ex - ox;
-        int y = ey - oy;
-        int z = ez - oz;
-        int f1 = !opaque[XYZ(x - 1, y, z)];
-        int f2 = !opaque[XYZ(x + 1, y, z)];
-        int f3 = !opaque[XYZ(x, y + 1, z)];
-        int f4 = !opaque[XYZ(x, y - 1, z)] && (ey > 0);
-        int f5 = !opaque[XYZ(x, y, z - 1)];
-        int f6 = !opaque[XYZ(x, y, z + 1)];
-        int total = f1 + f2 + f3 + f4 + f5 + f6;
-        if (total == 0) {
-            continue;
-        }
-        if (is_plant(ew)) {
-            total = 4;
+// Remove the light that a chunk that is about to be deleted gave to its
+// neighbors. The removal is finished by the next update_light(), after the
+// chunk is gone.
+// Arguments:
+// - chunk: chunk to be deleted
+// Returns: none
+void unload_chunk_light(
+        Model *g,
+        Chunk *chunk)
+{
+    if (!chunk->loaded) {
+        return;
+    }
+    int x0 = chunk->p * CHUNK_SIZE;
+    int z0 = chunk->q * CHUNK_SIZE;
+    int x1 = x0 + CHUNK_SIZE - 1;
+    int z1 = z0 + CHUNK_SIZE - 1;
+    BlockMap *map = &chunk->light_levels;
+    BLOCK_MAP_FOR_EACH(map, ex, ey, ez, ew) {
+        if (ex == x0 || ex == x1 || ez == z0 || ez == z1) {
+            light_forget(&g->light, ex, ey, ez, ew);
         }
-        miny = MIN(miny, ey);
-        maxy = MAX(maxy, ey);
-        faces += total;
-    } END_MAP_FOR_EACH;
+    } END_BLOCK_MAP_FOR_EACH;
+}
 
-    // generate geometry
-    GLfloat *data = malloc_faces(10, faces);
-    int offset = 0;
-    MAP_FOR_EACH(map, ex, ey, ez, ew) {
-        if (ew <= 0) {
-            continue;
-        }
-        int x = ex - ox;
-        int y = ey - oy;
-        int z = ez - oz;
-        int f1 = !opaque[XYZ(x - 1, y, z)];
-        int f2 = !opaque[XYZ(x + 1, y, z)];
-        int f3 = !opaque[XYZ(x, y + 1, z)];
-        int f4 = !opaque[XYZ(x, y - 1, z)] && (ey > 0);
-        int f5 = !opaque[XYZ(x, y, z - 1)];
-        int f6 = !opaque[XYZ(x, y, z + 1)];
-        int total = f1 + f2 + f3 + f4 + f5 + f6;
-        if (total == 0) {
+
+// Update the light levels after the light source at a block changed
+// Arguments:
+// - x, y, z: block position
+// - previous: previous intensity of the light source
+// - w: new intensity of the light source
+// Returns: none
+void change_light(
+        Model *g,
+        int x,
+        int y,
+        int z,
+        int previous,
+        int w)
+{
+    if (!SHOW_LIGHTS) {
+        return;
+    }
+    if (w < previous) {
+        light_remove(&g->light, x, y, z);
+    }
+    else {
+        light_add(&g->light, x, y, z, w);
+    }
+    update_light(g);
+}
+
+
+// Upload the mesh sections generated by a worker item to a chunk
+// Arguments:
+// - chunk
+// - item
+// Returns: none
+void generate_chunk(
+        Chunk *chunk,
+        WorkerItem *item)
+{
+    for (int i = 0; i < CHUNK_MESH_SECTIONS; i++) {
+        if (!(item->sections & (1 << i))) {
             continue;
         }
-        char neighbors[27] = {0};
-        char lights[27] = {0};
-        float shades[27] = {0};
-        int index = 0;
-        for (int dx = -1; dx <= 1; dx++) {
-            for (int dy = -1; dy <= 1; dy++) {
-                for (int dz = -1; dz <= 1; dz++) {
-                    neighbors[index] = opaque[XYZ(x + dx, y + dy, z + dz)];
-                    lights[index] = light[XYZ(x + dx, y + dy, z + dz)];
-                    shades[index] = 0;
-                    if (y + dy <= highest[XZ(x + dx, z + dz)]) {
-                        for (int oy = 0; oy < 8; oy++) {
-                            if (opaque[XYZ(x + dx, y + dy + oy, z + dz)]) {
-                                shades[index] = 1.0 - oy * 0.125;
-                                break;
-                            }
-                        }
-                    }
-                    index++;
-                }
-            }
+        ChunkMesh *mesh = chunk->meshes + i;
+        WorkerMesh *data = item->meshes + i;
+        mesh->miny = data->miny;
+        mesh->maxy = data->maxy;
+        mesh->faces = data->faces;
+        mesh->plant_faces = data->plant_faces;
+        del_buffer(mesh->buffer);
+        del_buffer(mesh->plant_buffer);
+        mesh->buffer = 0;
+        mesh->plant_buffer = 0;
+        if (data->faces) {
+            mesh->buffer = gen_buffer(
+                sizeof(ChunkVertex) * 4 * data->faces, data->data);
         }
-        float ao[6][4];
-        float light[6][4];
-        occlusion(neighbors, lights, shades, ao, light);
-        if (is_plant(ew)) {
-            total = 4;
-            float min_ao = 1;
-            float max_light = 0;
-            for (int a = 0; a < 6; a++) {
-                for (int b = 0; b < 4; b++) {
-                    min_ao = MIN(min_ao, ao[a][b]);
-                    max_light = MAX(max_light, light[a][b]);
-                }
-            }
-            float rotation = simplex2(ex, ez, 4, 0.5, 2) * 360;
-            make_plant(
-                    data + offset, min_ao, max_light,
-                    ex, ey, ez, 0.5, ew, rotation);
+        if (data->plant_faces) {
+            mesh->plant_buffer = gen_buffer(
+                sizeof(GLfloat) * 6 * 10 * data->plant_faces,
+                data->plant_data);
         }
-        else {
-            make_cube(
-                    data + offset, ao, light,
-                    f1, f2, f3, f4, f5, f6,
-                    ex, ey, ez, 0.5, ew);
+    }
+    chunk->faces = 0;
+    chunk->miny = 256;
+    chunk->maxy = 0;
+    for (int i = 0; i < CHUNK_MESH_SECTIONS; i++) {
+        ChunkMesh *mesh = chunk->meshes + i;
+        if (mesh->faces || mesh->plant_faces) {
+            chunk->faces += mesh->faces + mesh->plant_faces;
+            chunk->miny = MIN(chunk->miny, mesh->miny);
+            chunk->maxy = MAX(chunk->maxy, mesh->maxy);
         }
-        offset += total * 60;
-    } END_MAP_FOR_EACH;
-
-    free(opaque);
-    free(light);
-    free(highest);
-
-    item->miny = miny;
-    item->maxy = maxy;
-    item->faces = faces;
-    item->data = data;
+    }
+    chunk->generated = 1;
+    gen_sign_buffer(chunk);
 }
 
 
+// Upload the cloud faces made by load_chunk() to a chunk
 // Arguments:
 // - chunk
 // - item
 // Returns: none
-void generate_chunk(
+void gen_cloud_buffer(
         Chunk *chunk,
         WorkerItem *item)
 {
-    chunk->miny = item->miny;
-    chunk->maxy = item->maxy;
-    chunk->faces = item->faces;
-    del_buffer(chunk->buffer);
-    chunk->buffer = gen_faces(10, item->faces, item->data);
-    gen_sign_buffer(chunk);
+    ChunkMesh *mesh = &chunk->clouds;
+    del_buffer(mesh->buffer);
+    mesh->buffer = 0;
+    mesh->faces = item->cloud_faces;
+    mesh->miny = CLOUD_MIN_Y;
+    mesh->maxy = CLOUD_MAX_Y;
+    if (mesh->faces) {
+        mesh->buffer = gen_buffer(
+            sizeof(ChunkVertex) * 4 * mesh->faces, item->cloud_data);
+    }
 }
 
 
+// Generate the dirty mesh sections of a chunk on the main thread
 // Arguments:
 // - chunk
 // Returns: none
@@ -1474,27 +1591,24 @@ void gen_chunk_buffer(
         Model *g,
         Chunk *chunk)
 {
-    WorkerItem _item;
-    WorkerItem *item = &_item;
+    WorkerItem *item = &g->item;
     item->p = chunk->p;
     item->q = chunk->q;
+    item->sections = chunk->dirty;
+    item->noise = &g->noise;
+    item->generator = g->generator;
+    item->block_map = &chunk->map;
     for (int dp = -1; dp <= 1; dp++) {
         for (int dq = -1; dq <= 1; dq++) {
             Chunk *other = chunk;
             if (dp || dq) {
                 other = find_chunk(g, chunk->p + dp, chunk->q + dq);
             }
-            if (other) {
-                item->block_maps[dp + 1][dq + 1] = &other->map;
-                item->light_maps[dp + 1][dq + 1] = &other->lights;
-            }
-            else {
-                item->block_maps[dp + 1][dq + 1] = 0;
-                item->light_maps[dp + 1][dq + 1] = 0;
-            }
+            item->level_maps[dp + 1][dq + 1] =
+                other ? &other->light_levels : 0;
         }
     }
-    compute_chunk(item);
+    compute_chunk(item, &g->scratch);
     generate_chunk(chunk, item);
     chunk->dirty = 0;
 }
@@ -1506,10 +1620,10 @@ void gen_chunk_buffer(
 // - y: y position
 // - z: z position
 // - w: block type
-// - arg: pointer to map (is void* so that world gen doesn't need to know the type)
+// - arg: pointer to block map (is void* so that world gen doesn't need to know the type)
 // Returns:
 // - no return value
-// - modifies the Map pointed to by "arg"
+// - modifies the BlockMap pointed to by "arg"
 void map_set_func(
         int x,
         int y,
@@ -1517,11 +1631,14 @@ void map_set_func(
         int w,
         void *arg)
 {
-    Map *map = (Map *)arg;
-    map_set(map, x, y, z, w);
+    BlockMap *map = (BlockMap *)arg;
+    block_map_set(map, x, y, z, w);
 }
 
 
+// Load the blocks, lights, damage and heightmap of a chunk. Chunks that have
+// been baked (see craft_pregen) are read instead of generated, and the saved
+// edits are applied on top either way.
 // Arguments:
 // - item
 // Returns: none
@@ -1531,16 +1648,26 @@ void load_chunk(
     int p = item->p;
     int q = item->q;
 
-    Map *block_map = item->block_maps[1][1];
-    create_world(p, q, map_set_func, block_map);
-    db_load_blocks(block_map, p, q);
-
-    Map *light_map = item->light_maps[1][1];
-    db_load_lights(light_map, p, q);
-
-    Map *dam_map = item->damage_maps[1][1];
+    BlockMap *block_map = item->block_map;
+    Map *light_map = item->light_map;
+    Heightmap *heightmap = &item->heightmap;
+    int baked = db_load_bake(
+        block_map, light_map, heightmap, p, q, item->generator);
+    if (!baked) {
+        create_world(
+            p, q, item->noise, item->generator, map_set_func, block_map);
+    }
+    Map *dam_map = item->damage_map;
     db_trim_block_damage(p, q);
-    db_load_damage(dam_map, p, q);
+    int edits = db_load_chunk(block_map, light_map, dam_map, p, q);
+    if (!baked || edits) {
+        heightmap_build(heightmap, block_map, p, q);
+    }
+
+    if (!item->cloud_data) {
+        item->cloud_data = malloc(sizeof(ChunkVertex) * 4 * CLOUD_MAX_FACES);
+    }
+    item->cloud_faces = compute_clouds(p, q, item->noise, item->cloud_data);
 }
 
 
@@ -1572,19 +1699,28 @@ void init_chunk(
     chunk->q = q;
     chunk->faces = 0;
     chunk->sign_faces = 0;
-    chunk->buffer = 0;
     chunk->sign_buffer = 0;
-    dirty_chunk(g, chunk);
+    chunk->dirty = CHUNK_DIRTY_ALL | CHUNK_DIRTY_SIGNS;
+    chunk->job = 0;
+    chunk->loaded = 0;
+    chunk->generated = 0;
+    chunk->miny = 256;
+    chunk->maxy = 0;
+    memset(chunk->meshes, 0, sizeof(chunk->meshes));
+    memset(&chunk->clouds, 0, sizeof(chunk->clouds));
+    chunk_index_add(g, chunk);
     SignList *signs = &chunk->signs;
     sign_list_alloc(signs, 16);
     db_load_signs(signs, p, q);
-    Map *block_map = &chunk->map;
+    BlockMap *block_map = &chunk->map;
     Map *dam_map = &chunk->damage;
     Map *light_map = &chunk->lights;
     int dx = p * CHUNK_SIZE - 1;
     int dy = 0;
     int dz = q * CHUNK_SIZE - 1;
-    map_alloc(block_map, dx, dy, dz, 0x7fff);
+    block_map_alloc(block_map, dx, dy, dz);
+    block_map_alloc(&chunk->light_levels, dx, dy, dz);
+    heightmap_build(&chunk->heightmap, block_map, p, q);
     map_alloc(dam_map, dx, dy, dz, 0x7fff);
     map_alloc(light_map, dx, dy, dz, 0xf);
 }
@@ -1607,10 +1743,17 @@ void create_chunk(
     WorkerItem *item = &_item;
     item->p = chunk->p;
     item->q = chunk->q;
-    item->block_maps[1][1] = &chunk->map;
-    item->light_maps[1][1] = &chunk->lights;
-    item->damage_maps[1][1] = &chunk->damage;
+    item->block_map = &chunk->map;
+    item->light_map = &chunk->lights;
+    item->damage_map = &chunk->damage;
+    item->noise = &g->noise;
+    item->generator = g->generator;
+    item->cloud_data = 0;
     load_chunk(item);
+    chunk->heightmap = item->heightmap;
+    load_chunk_light(g, chunk);
+    gen_cloud_buffer(chunk, item);
+    free(item->cloud_data);
 
     request_chunk(p, q);
 }
@@ -1642,17 +1785,29 @@ void delete_chunks(
             }
         }
         if (delete) {
-            map_free(&chunk->map);
+            unload_chunk_light(g, chunk);
+            block_map_free(&chunk->map);
+            block_map_free(&chunk->light_levels);
             map_free(&chunk->lights);
             map_free(&chunk->damage);
             sign_list_free(&chunk->signs);
-            del_buffer(chunk->buffer);
+            for (int j = 0; j < CHUNK_MESH_SECTIONS; j++) {
+                del_buffer(chunk->meshes[j].buffer);
+                del_buffer(chunk->meshes[j].plant_buffer);
+            }
+            del_buffer(chunk->clouds.buffer);
             del_buffer(chunk->sign_buffer);
+            chunk_index_remove(g, chunk);
             Chunk *other = g->chunks + (--count);
+            if (other != chunk) {
+                int slot = chunk_index_slot(g, other->p, other->q);
+                g->chunk_index[slot] = i + 1;
+            }
             memcpy(chunk, other, sizeof(Chunk));
         }
     }
     g->chunk_count = count;
+    update_light(g);
 }
 
 
@@ -1664,73 +1819,113 @@ void delete_all_chunks(
 {
     for (int i = 0; i < g->chunk_count; i++) {
         Chunk *chunk = g->chunks + i;
-        map_free(&chunk->map);
+        block_map_free(&chunk->map);
+        block_map_free(&chunk->light_levels);
         map_free(&chunk->lights);
         map_free(&chunk->damage);
         sign_list_free(&chunk->signs);
-        del_buffer(chunk->buffer);
+        for (int j = 0; j < CHUNK_MESH_SECTIONS; j++) {
+            del_buffer(chunk->meshes[j].buffer);
+            del_buffer(chunk->meshes[j].plant_buffer);
+        }
+        del_buffer(chunk->clouds.buffer);
         del_buffer(chunk->sign_buffer);
     }
     g->chunk_count = 0;
+    g->light_chunk = 0;
+    memset(g->chunk_index, 0, sizeof(g->chunk_index));
 }
 
-// Arguments: none
+// Release a worker item's chunk snapshots and return it to the scheduler
+// Arguments:
+// - item: collected worker item
 // Returns: none
-void check_workers(
-        Model *g)
+void release_worker_item(
+        Model *g,
+        WorkerItem *item)
 {
-    for (int i = 0; i < WORKERS; i++) {
-        Worker *worker = g->workers + i;
-        mtx_lock(&worker->mtx);
-        if (worker->state == WORKER_DONE) {
-            WorkerItem *item = &worker->item;
-            Chunk *chunk = find_chunk(g, item->p, item->q);
-            if (chunk) {
-                if (item->load) {
-                    Map *block_map = item->block_maps[1][1];
-                    map_free(&chunk->map);
-                    map_copy(&chunk->map, block_map);
+    BlockMap *block_map = item->block_map;
+    block_map_free(block_map);
+    free(block_map);
 
-                    Map *light_map = item->light_maps[1][1];
-                    map_free(&chunk->lights);
-                    map_copy(&chunk->lights, light_map);
+    Map *light_map = item->light_map;
+    if (light_map) {
+        map_free(light_map);
+        free(light_map);
+    }
 
-                    Map *dam_map = item->damage_maps[1][1];
-                    map_free(&chunk->damage);
-                    map_copy(&chunk->damage, dam_map);
+    Map *dam_map = item->damage_map;
+    if (dam_map) {
+        map_free(dam_map);
+        free(dam_map);
+    }
 
-                    request_chunk(item->p, item->q);
-                }
-                generate_chunk(chunk, item);
+    for (int a = 0; a < 3; a++) {
+        for (int b = 0; b < 3; b++) {
+            BlockMap *level_map = item->level_maps[a][b];
+            if (level_map) {
+                block_map_free(level_map);
+                free(level_map);
             }
-            for (int a = 0; a < 3; a++) {
-                for (int b = 0; b < 3; b++) {
-                    Map *block_map = item->block_maps[a][b];
-                    if (block_map) {
-                        map_free(block_map);
-                        free(block_map);
-                    }
-
-                    Map *light_map = item->light_maps[a][b];
-                    if (light_map) {
-                        map_free(light_map);
-                        free(light_map);
-                    }
+        }
+    }
+    scheduler_free_item(&g->scheduler, item);
+}
 
-                    Map *dam_map = item->damage_maps[a][b];
-                    if (dam_map) {
-                        map_free(dam_map);
-                        free(dam_map);
-                    }
-                }
+// Apply the results of finished worker items to their chunks.
+// Results for chunks that were deleted (or deleted and created again) since
+// the item was submitted are thrown away.
+// Arguments: none
+// Returns: none
+void check_workers(
+        Model *g)
+{
+    WorkerItem *items[MAX_WORKER_ITEMS];
+    int count = scheduler_collect(&g->scheduler, items, MAX_WORKER_ITEMS);
+    for (int i = 0; i < count; i++) {
+        WorkerItem *item = items[i];
+        Chunk *chunk = find_chunk(g, item->p, item->q);
+        if (chunk && chunk->job == item->id) {
+            chunk->job = 0;
+            if (item->load) {
+                BlockMap *block_map = item->block_map;
+                block_map_free(&chunk->map);
+                block_map_copy(&chunk->map, block_map);
+
+                Map *light_map = item->light_map;
+                map_free(&chunk->lights);
+                map_copy(&chunk->lights, light_map);
+
+                Map *dam_map = item->damage_map;
+                map_free(&chunk->damage);
+                map_copy(&chunk->damage, dam_map);
+
+                chunk->heightmap = item->heightmap;
+
+                request_chunk(item->p, item->q);
+                load_chunk_light(g, chunk);
+                gen_cloud_buffer(chunk, item);
             }
-            worker->state = WORKER_IDLE;
+            generate_chunk(chunk, item);
         }
-        mtx_unlock(&worker->mtx);
+        release_worker_item(g, item);
+    }
+}
+
+// Wait for all submitted worker items to finish and apply their results.
+// Arguments: none
+// Returns: none
+void wait_workers(
+        Model *g)
+{
+    while (scheduler_busy(&g->scheduler)) {
+        check_workers(g);
+        thrd_yield();
     }
 }
 
 // Force the chunks around the given player to generate on this main thread.
+// Chunks that are already being worked on are left to their worker.
 // Arguments:
 // - player: player to generate chunks for
 // Returns: none
@@ -1748,7 +1943,7 @@ void force_chunks(
             int b = q + dq;
             Chunk *chunk = find_chunk(g, a, b);
             if (chunk) {
-                if (chunk->dirty) {
+                if (chunk->dirty && !chunk->job) {
                     gen_chunk_buffer(g, chunk);
                 }
             }
@@ -1762,74 +1957,68 @@ void force_chunks(
 }
 
 
+// A chunk that needs a worker, see ensure_chunks()
+typedef struct {
+    int score;
+    int a;
+    int b;
+} ChunkJob;
+
+
+int chunk_job_compare(
+        const void *a,
+        const void *b)
+{
+    return ((const ChunkJob *)a)->score - ((const ChunkJob *)b)->score;
+}
+
+
+// Submit a worker item to load and/or generate the given chunk
 // Arguments:
-// - player
-// - worker
+// - chunk: chunk to work on (which has no item in progress)
+// - load: whether the chunk's blocks need to be loaded first
+// - item: unused worker item
 // Returns: none
 void ensure_chunks_worker(
         Model *g,
-        Player *player,
-        Worker *worker)
+        Chunk *chunk,
+        int load,
+        WorkerItem *item)
 {
-    State *s = &player->state;
-    float matrix[16];
-    set_matrix_3d_player_camera(g, matrix, player);
-    float planes[6][4];
-    frustum_planes(planes, g->render_radius, matrix);
-    int p = chunked(s->x);
-    int q = chunked(s->z);
-    int r = g->create_radius;
-    int start = 0x0fffffff;
-    int best_score = start;
-    int best_a = 0;
-    int best_b = 0;
-    for (int dp = -r; dp <= r; dp++) {
-        for (int dq = -r; dq <= r; dq++) {
-            int a = p + dp;
-            int b = q + dq;
-            int index = (ABS(a) ^ ABS(b)) % WORKERS;
-            if (index != worker->index) {
-                continue;
-            }
-            Chunk *chunk = find_chunk(g, a, b);
-            if (chunk && !chunk->dirty) {
-                continue;
-            }
-            int distance = MAX(ABS(dp), ABS(dq));
-            int invisible = !chunk_visible(g, planes, a, b, 0, 256);
-            int priority = 0;
-            if (chunk) {
-                priority = chunk->buffer && chunk->dirty;
-            }
-            int score = (invisible << 24) | (priority << 16) | distance;
-            if (score < best_score) {
-                best_score = score;
-                best_a = a;
-                best_b = b;
-            }
-        }
-    }
-    if (best_score == start) {
-        return;
-    }
-    int a = best_a;
-    int b = best_b;
-    int load = 0;
-    Chunk *chunk = find_chunk(g, a, b);
-    if (!chunk) {
-        load = 1;
-        if (g->chunk_count < MAX_CHUNKS) {
-            chunk = g->chunks + g->chunk_count++;
-            init_chunk(g, chunk, a, b);
-        }
-        else {
-            return;
-        }
-    }
-    WorkerItem *item = &worker->item;
+    // The worker gets copy-on-write snapshots, so no block data is copied
+    // here unless the main thread later modifies a chunk while the worker
+    // is still reading it. The chunk's block map already has the one block
+    // border of its neighbors that meshing needs, and of the neighbors only
+    // the light levels at their edges are read.
+    // Only a load writes to its maps, and it gets new private ones instead.
     item->p = chunk->p;
     item->q = chunk->q;
     item->load = load;
+    item->noise = &g->noise;
+    item->generator = g->generator;
+    BlockMap *block_map = malloc(sizeof(BlockMap));
+    if (load) {
+        block_map_alloc(block_map,
+                chunk->map.dx, chunk->map.dy, chunk->map.dz);
+
+        Map *light_map = malloc(sizeof(Map));
+        map_alloc(light_map, chunk->lights.dx, chunk->lights.dy,
+                chunk->lights.dz, chunk->lights.mask);
+        item->light_map = light_map;
+
+        Map *dam_map = malloc(sizeof(Map));
+        map_alloc(dam_map, chunk->damage.dx, chunk->damage.dy,
+                chunk->damage.dz, chunk->damage.mask);
+        item->damage_map = dam_map;
+    }
+    else {
+        block_map_copy(block_map, &chunk->map);
+
+        // Meshing does not read light sources or block damage
+        item->light_map = 0;
+        item->damage_map = 0;
+    }
+    item->block_map = block_map;
     for (int dp = -1; dp <= 1; dp++) {
         for (int dq = -1; dq <= 1; dq++) {
             Chunk *other = chunk;
@@ -1837,30 +2026,25 @@ void ensure_chunks_worker(
                 other = find_chunk(g, chunk->p + dp, chunk->q + dq);
             }
             if (other) {
-                Map *block_map = malloc(sizeof(Map));
-                map_copy(block_map, &other->map);
-                item->block_maps[dp + 1][dq + 1] = block_map;
-
-                Map *light_map = malloc(sizeof(Map));
-                map_copy(light_map, &other->lights);
-                item->light_maps[dp + 1][dq + 1] = light_map;
-
-                Map *dam_map = malloc(sizeof(Map));
-                map_copy(dam_map, &other->damage);
-                item->damage_maps[dp + 1][dq + 1] = dam_map;
+                BlockMap *level_map = malloc(sizeof(BlockMap));
+                block_map_copy(level_map, &other->light_levels);
+                item->level_maps[dp + 1][dq + 1] = level_map;
             }
             else {
-                item->block_maps[dp + 1][dq + 1] = 0;
-                item->light_maps[dp + 1][dq + 1] = 0;
-                item->damage_maps[dp + 1][dq + 1] = 0;
+                item->level_maps[dp + 1][dq + 1] = 0;
             }
         }
     }
+    item->sections = chunk->dirty;
     chunk->dirty = 0;
-    worker->state = WORKER_BUSY;
-    cnd_signal(&worker->cnd);
+    chunk->job = item->id;
+    scheduler_submit(&g->scheduler, item);
 }
 
+// Hand out chunks that need to be loaded or generated to the workers, in
+// order of their score: visible chunks before invisible ones, chunks without
+// a buffer before chunks that only need to be regenerated, and then nearer
+// chunks before farther ones.
 // Arguments:
 // - player
 // Returns: none
@@ -1870,41 +2054,72 @@ void ensure_chunks(
 {
     check_workers(g);
     force_chunks(g, player);
-    for (int i = 0; i < WORKERS; i++) {
-        Worker *worker = g->workers + i;
-        mtx_lock(&worker->mtx);
-        if (worker->state == WORKER_IDLE) {
-            ensure_chunks_worker(g, player, worker);
+    Scheduler *scheduler = &g->scheduler;
+    if (!scheduler->free_count) {
+        return;
+    }
+    State *s = &player->state;
+    float matrix[16];
+    set_matrix_3d_player_camera(g, matrix, player);
+    float planes[6][4];
+    frustum_planes(planes, g->render_radius, matrix);
+    int p = chunked(s->x);
+    int q = chunked(s->z);
+    int r = g->create_radius;
+    ChunkJob *jobs = malloc(sizeof(ChunkJob) * (2 * r + 1) * (2 * r + 1));
+    int count = 0;
+    for (int dp = -r; dp <= r; dp++) {
+        for (int dq = -r; dq <= r; dq++) {
+            int a = p + dp;
+            int b = q + dq;
+            Chunk *chunk = find_chunk(g, a, b);
+            if (chunk && (!chunk->dirty || chunk->job)) {
+                continue;
+            }
+            int distance = MAX(ABS(dp), ABS(dq));
+            int invisible = !chunk_visible(g, planes, a, b, 0, 256);
+            int priority = 0;
+            if (chunk) {
+                priority = chunk->generated && chunk->dirty;
+            }
+            ChunkJob *job = jobs + count++;
+            job->score = (invisible << 24) | (priority << 16) | distance;
+            job->a = a;
+            job->b = b;
+        }
+    }
+    qsort(jobs, count, sizeof(ChunkJob), chunk_job_compare);
+    for (int i = 0; i < count && scheduler->free_count; i++) {
+        int a = jobs[i].a;
+        int b = jobs[i].b;
+        int load = 0;
+        Chunk *chunk = find_chunk(g, a, b);
+        if (!chunk) {
+            if (g->chunk_count >= MAX_CHUNKS) {
+                continue;
+            }
+            load = 1;
+            chunk = g->chunks + g->chunk_count++;
+            init_chunk(g, chunk, a, b);
         }
-        mtx_unlock(&worker->mtx);
+        ensure_chunks_worker(g, chunk, load, scheduler_alloc_item(scheduler));
     }
+    free(jobs);
 }
 
+// Work on a worker item (called by the worker threads)
 // Arguments:
-// - arg
-// Returns:
-// - integer
-int worker_run(
-        void *arg)
+// - worker: worker thread that runs the item
+// - item
+// Returns: none
+void worker_run(
+        Worker *worker,
+        WorkerItem *item)
 {
-    Worker *worker = (Worker *)arg;
-    int running = 1;
-    while (running) {
-        mtx_lock(&worker->mtx);
-        while (worker->state != WORKER_BUSY) {
-            cnd_wait(&worker->cnd, &worker->mtx);
-        }
-        mtx_unlock(&worker->mtx);
-        WorkerItem *item = &worker->item;
-        if (item->load) {
-            load_chunk(item);
-        }
-        compute_chunk(item);
-        mtx_lock(&worker->mtx);
-        worker->state = WORKER_DONE;
-        mtx_unlock(&worker->mtx);
+    if (item->load) {
+        load_chunk(item);
     }
-    return 0;
+    compute_chunk(item, &worker->scratch);
 }
 
 // Arguments:
@@ -1924,7 +2139,7 @@ void unset_sign(
     if (chunk) {
         SignList *signs = &chunk->signs;
         if (sign_list_remove_all(signs, x, y, z)) {
-            chunk->dirty = 1;
+            chunk->dirty |= CHUNK_DIRTY_SIGNS;
             db_delete_signs(x, y, z);
         }
     }
@@ -1952,7 +2167,7 @@ void unset_sign_face(
     if (chunk) {
         SignList *signs = &chunk->signs;
         if (sign_list_remove(signs, x, y, z, face)) {
-            chunk->dirty = 1;
+            chunk->dirty |= CHUNK_DIRTY_SIGNS;
             db_delete_sign(x, y, z, face);
         }
     }
@@ -1990,7 +2205,7 @@ _set_sign(
         SignList *signs = &chunk->signs;
         sign_list_add(signs, x, y, z, face, text);
         if (dirty) {
-            chunk->dirty = 1;
+            chunk->dirty |= CHUNK_DIRTY_SIGNS;
         }
     }
     db_insert_sign(p, q, x, y, z, face, text);
@@ -2031,11 +2246,12 @@ void toggle_light(
     Chunk *chunk = find_chunk(g, p, q);
     if (chunk) {
         Map *map = &chunk->lights;
-        int w = map_get(map, x, y, z) ? 0 : 15;
+        int previous = map_get(map, x, y, z);
+        int w = previous ? 0 : 15;
         map_set(map, x, y, z, w);
         db_insert_light(p, q, x, y, z, w);
         client_light(x, y, z, w);
-        dirty_chunk(g, chunk);
+        change_light(g, x, y, z, previous, w);
     }
 }
 
@@ -2058,8 +2274,9 @@ set_light(
     Chunk *chunk = find_chunk(g, p, q);
     if (chunk) {
         Map *map = &chunk->lights;
+        int previous = map_get(map, x, y, z);
         if (map_set(map, x, y, z, w)) {
-            dirty_chunk(g, chunk);
+            change_light(g, x, y, z, previous, w);
             db_insert_light(p, q, x, y, z, w);
         }
     }
@@ -2087,21 +2304,30 @@ void _set_block(
 {
     Chunk *chunk = find_chunk(g, p, q);
     if (chunk) {
-        Map *map = &chunk->map;
-        if (map_set(map, x, y, z, w)) {
+        BlockMap *map = &chunk->map;
+        int previous = block_map_get(map, x, y, z);
+        if (block_map_set(map, x, y, z, w)) {
+            heightmap_update(&chunk->heightmap, map, x, y, z);
             if (dirty) {
-                dirty_chunk(g, chunk);
+                dirty_block(g, x, y, z);
+            }
+            // Only the chunk that owns the block keeps its light level, and
+            // a chunk that is still loading is lit when its load is done
+            int own = chunked(x) == p && chunked(z) == q && chunk->loaded;
+            if (own && is_transparent(previous) != is_transparent(w)) {
+                light_block_changed(&g->light, x, y, z);
+                update_light(g);
             }
             db_insert_block(p, q, x, y, z, w);
         }
+        // Reset damage for deleted blocks
+        if (w == 0) {
+            map_set(&chunk->damage, x, y, z, 0);
+        }
     }
     else {
         db_insert_block(p, q, x, y, z, w);
     }
-    // Reset damage for deleted blocks
-    if (w == 0) {
-        map_set(&chunk->damage, x, y, z, 0);
-    }
     // If a block is removed, then remove any signs and light source from that block.
     if (w == 0 && chunked(x) == p && chunked(z) == q) {
         unset_sign(g, x, y, z);
@@ -2180,7 +2406,7 @@ int get_block(
 {
     Chunk *chunk = find_chunk_xyz(g, x, z);
     if (!chunk) { return 0; }
-    return map_get(&chunk->map, x, y, z);
+    return block_map_get(&chunk->map, x, y, z);
 }
 
 
@@ -2210,7 +2436,7 @@ get_block_and_damage(
 {
     Chunk *chunk = find_chunk_xyz(g, x, z);
     if (!chunk) { return 0; }
-    if (w) { *w = map_get(&chunk->map, x, y, z); }
+    if (w) { *w = block_map_get(&chunk->map, x, y, z); }
     if (damage) { *damage = map_get(&chunk->damage, x, y, z); }
     return 1;
 }
@@ -2273,13 +2499,15 @@ builder_block(
 
 
 // Arguments:
-// - attrib
+// - attrib: chunk shader attributes, for the block faces
+// - plant_attrib: block shader attributes, for the plants
 // - player
 // Returns:
 // - number of faces
 int render_chunks(
         Model *g,
         Attrib *attrib,
+        Attrib *plant_attrib,
         Player *player)
 {
     int result = 0;
@@ -2293,26 +2521,65 @@ int render_chunks(
     set_matrix_3d_player_camera(g, matrix, player);
     float planes[6][4];
     frustum_planes(planes, g->render_radius, matrix);
-    glUseProgram(attrib->program);
-    glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, matrix);
-    glUniform3f(attrib->camera, s->x, eye_y, s->z);
-    glUniform1i(attrib->sampler, 0);
-    glUniform1i(attrib->extra1, 2);
-    glUniform1f(attrib->extra2, light);
-    glUniform1f(attrib->extra3, g->render_radius * CHUNK_SIZE);
-    glUniform1i(attrib->extra4, g->ortho);
-    glUniform1f(attrib->timer, time_of_day(g));
-    for (int i = 0; i < g->chunk_count; i++) {
-        Chunk *chunk = g->chunks + i;
-        if (chunk_distance(chunk, p, q) > g->render_radius) {
-            continue;
-        }
-        if (!chunk_visible(g, planes, chunk->p, chunk->q, chunk->miny, chunk->maxy)) {
-            continue;
+    // block faces are drawn first, then plants with the block shader
+    Attrib *programs[2] = {attrib, plant_attrib};
+    for (int k = 0; k < 2; k++) {
+        Attrib *a = programs[k];
+        glUseProgram(a->program);
+        glUniformMatrix4fv(a->matrix, 1, GL_FALSE, matrix);
+        glUniform3f(a->camera, s->x, eye_y, s->z);
+        glUniform1i(a->sampler, 0);
+        glUniform1i(a->extra1, 2);
+        glUniform1f(a->extra2, light);
+        glUniform1f(a->extra3, g->render_radius * CHUNK_SIZE);
+        glUniform1i(a->extra4, g->ortho);
+        glUniform1f(a->timer, time_of_day(g));
+        for (int i = 0; i < g->chunk_count; i++) {
+            Chunk *chunk = g->chunks + i;
+            if (chunk_distance(chunk, p, q) > g->render_radius) {
+                continue;
+            }
+            ChunkMesh *clouds = &chunk->clouds;
+            if (!k && clouds->faces && chunk_visible(
+                    g, planes, chunk->p, chunk->q, clouds->miny, clouds->maxy))
+            {
+                glUniform3f(a->extra5,
+                        chunk->p * CHUNK_SIZE - 0.5,
+                        CLOUD_MIN_Y - 0.5,
+                        chunk->q * CHUNK_SIZE - 0.5);
+                bind_quad_indices(g, clouds->faces);
+                draw_chunk_mesh(a, clouds);
+            }
+            if (!chunk_visible(g, planes, chunk->p, chunk->q, chunk->miny, chunk->maxy)) {
+                continue;
+            }
+            for (int j = 0; j < CHUNK_MESH_SECTIONS; j++) {
+                ChunkMesh *mesh = chunk->meshes + j;
+                int faces = k ? mesh->plant_faces : mesh->faces;
+                if (!faces) {
+                    continue;
+                }
+                if (!chunk_visible(g, planes, chunk->p, chunk->q, mesh->miny, mesh->maxy)) {
+                    continue;
+                }
+                if (k) {
+                    draw_triangles_3d_ao(a, mesh->plant_buffer, faces * 6);
+                }
+                else {
+                    // vertex positions are relative to the section's first
+                    // block corner
+                    glUniform3f(a->extra5,
+                            chunk->p * CHUNK_SIZE - 0.5,
+                            j * CHUNK_MESH_HEIGHT - 0.5,
+                            chunk->q * CHUNK_SIZE - 0.5);
+                    bind_quad_indices(g, faces);
+                    draw_chunk_mesh(a, mesh);
+                }
+                result += faces;
+            }
         }
-        draw_chunk(attrib, chunk);
-        result += chunk->faces;
     }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     return result;
 }
 
@@ -3609,7 +3876,7 @@ parse_buffer(
         if (sscanf(line, "R,%d,%d", &kp, &kq) == 2) {
             Chunk *chunk = find_chunk(g, kp, kq);
             if (chunk) {
-                dirty_chunk(g, chunk);
+                dirty_chunk(chunk);
             }
         }
         // Time sync
@@ -3683,6 +3950,8 @@ reset_model(
 {
     memset(g->chunks, 0, sizeof(Chunk) * MAX_CHUNKS);
     g->chunk_count = 0;
+    g->light_chunk = 0;
+    memset(g->chunk_index, 0, sizeof(g->chunk_index));
     memset(g->players, 0, sizeof(Player) * MAX_PLAYERS);
     g->player_count = 0;
     g->observe1 = 0;
@@ -3,6 +3,7 @@
 
 
 #include "GameModel.h"
+#include "blockmap.h"
 #include "config.h"
 #include "cube.h"
 #include "hitbox.h"
@@ -43,6 +44,7 @@ enum {
 // - extra2:
 // - extra3:
 // - extra4:
+// - extra5:
 typedef struct {
     GLuint program;
     GLuint position;
@@ -56,6 +58,7 @@ typedef struct {
     GLuint extra2;
     GLuint extra3;
     GLuint extra4;
+    GLuint extra5;
 } Attrib;
 
 
@@ -80,7 +83,7 @@ _gen_sign_buffer(
 
 int
 _hit_test(
-        Map *map,
+        BlockMap *map,
         float max_distance,
         int previous,
         float x,
@@ -138,6 +141,11 @@ array(
         int yc,
         int zc);
 
+void
+bind_quad_indices(
+        Model *g,
+        int quads);
+
 int
 box_intersect_world(
         Model *g,
@@ -184,6 +192,15 @@ calc_damage_from_impulse(
         Model *g,
         float d_vel);
 
+void
+change_light(
+        Model *g,
+        int x,
+        int y,
+        int z,
+        int previous,
+        int w);
+
 void
 check_workers(
         Model *g);
@@ -194,6 +211,22 @@ chunk_distance(
         int p,
         int q);
 
+void
+chunk_index_add(
+        Model *g,
+        Chunk *chunk);
+
+void
+chunk_index_remove(
+        Model *g,
+        Chunk *chunk);
+
+int
+chunk_index_slot(
+        Model *g,
+        int p,
+        int q);
+
 int 
 chunk_visible(
         Model *g,
@@ -207,10 +240,6 @@ int
 chunked(
         float x);
 
-void
-compute_chunk(
-        WorkerItem *item);
-
 void
 copy(
         Model *g);
@@ -255,14 +284,30 @@ delete_player(
         int id);
 
 void
-dirty_chunk(
+dirty_block(
         Model *g,
+        int x,
+        int y,
+        int z);
+
+void
+dirty_blocks(
+        Model *g,
+        int x0,
+        int y0,
+        int z0,
+        int x1,
+        int y1,
+        int z1);
+
+void
+dirty_chunk(
         Chunk *chunk);
 
 void
-draw_chunk(
+draw_chunk_mesh(
         Attrib *attrib,
-        Chunk *chunk);
+        ChunkMesh *mesh);
 
 void
 draw_cube(
@@ -347,8 +392,9 @@ ensure_chunks(
 void
 ensure_chunks_worker(
         Model *g,
-        Player *player,
-        Worker *worker);
+        Chunk *chunk,
+        int load,
+        WorkerItem *item);
 
 Chunk *
 find_chunk(
@@ -362,6 +408,12 @@ find_chunk_xyz(
         int x,
         int z);
 
+Chunk *
+find_light_chunk(
+        Model *g,
+        int x,
+        int z);
+
 Player *
 find_player(
         Model *g,
@@ -377,6 +429,11 @@ gen_chunk_buffer(
         Model *g,
         Chunk *chunk);
 
+void
+gen_cloud_buffer(
+        Chunk *chunk,
+        WorkerItem *item);
+
 GLuint
 gen_crosshair_buffer();
 
@@ -480,11 +537,6 @@ handle_movement(
         Model *g,
         double dt);
 
-int
-has_lights(
-        Model *g,
-        Chunk *chunk);
-
 int
 highest_block(
         Model *g,
@@ -520,6 +572,10 @@ init_chunk(
         int p,
         int q);
 
+void
+init_light(
+        Model *g);
+
 int
 is_block_face_covered(
         Model *g,
@@ -530,20 +586,48 @@ is_block_face_covered(
         float ny,
         float nz);
 
+int
+light_get_level(
+        void *arg,
+        int x,
+        int y,
+        int z);
+
+int
+light_get_source(
+        void *arg,
+        int x,
+        int y,
+        int z);
+
+int
+light_is_opaque(
+        void *arg,
+        int x,
+        int y,
+        int z);
+
 void
-light_fill(
-        char *opaque,
-        char *light,
+light_set_level(
+        void *arg,
         int x,
         int y,
         int z,
-        int w,
-        int force);
+        int w);
 
 void
 load_chunk(
         WorkerItem *item);
 
+void
+load_chunk_light(
+        Model *g,
+        Chunk *chunk);
+
+void
+load_world_generator(
+        Model *g);
+
 void
 login();
 
@@ -555,13 +639,6 @@ map_set_func(
         int w,
         void *arg);
 
-void
-occlusion(
-        char neighbors[27],
-        char lights[27],
-        float shades[27],
-        float ao[6][4],
-        float light[6][4]);
 
 void
 on_left_click(
@@ -641,6 +718,7 @@ int
 render_chunks(
         Model *g,
         Attrib *attrib,
+        Attrib *plant_attrib,
         Player *player);
 
 void
@@ -700,6 +778,11 @@ render_wireframe(
         Attrib *attrib,
         Player *player);
 
+void
+release_worker_item(
+        Model *g,
+        WorkerItem *item);
+
 void
 request_chunk(
         int p,
@@ -767,6 +850,11 @@ tree(
         Model *g,
         Block *block);
 
+void
+unload_chunk_light(
+        Model *g,
+        Chunk *chunk);
+
 void
 unset_sign(
         Model *g,
@@ -782,9 +870,18 @@ unset_sign_face(
         int z,
         int face);
 
-int
+void
+update_light(
+        Model *g);
+
+void
+wait_workers(
+        Model *g);
+
+void
 worker_run(
-        void *arg);
+        Worker *worker,
+        WorkerItem *item);
 
 void
 input_get_keys_view(
@@ -0,0 +1,147 @@
+#include "heightmap.h"
+#include "item.h"
+#include "util.h"
+
+// This file contains the column heightmaps of chunks, which answer "what is
+// the highest block here" without searching the chunk's blocks.
+
+
+// Find the highest block of a column at or below a given y that a predicate
+// accepts, skipping the empty sections of the block map.
+// Arguments:
+// - map: block map of the chunk
+// - x, z: world position of the column
+// - y: highest y to look at
+// - predicate: is_obstacle or a function like it
+// Returns:
+// - y of the block, or -1 if there is none
+static int column_top(
+        const BlockMap *map,
+        int x,
+        int z,
+        int y,
+        int (*predicate)(int))
+{
+    int cx = x - map->dx;
+    int cz = z - map->dz;
+    for (y -= map->dy; y >= 0; y--) {
+        const BlockSection *section = map->sections[y / BLOCK_SECTION_HEIGHT];
+        if (!section->count) {
+            y -= y % BLOCK_SECTION_HEIGHT;
+            continue;
+        }
+        int i = BLOCK_SECTION_INDEX(cx, y % BLOCK_SECTION_HEIGHT, cz);
+        if (predicate(block_section_get(section, i))) {
+            return y + map->dy;
+        }
+    }
+    return -1;
+}
+
+
+static int is_opaque(int w) {
+    return !is_transparent(w);
+}
+
+
+// Find the top of every column of a chunk
+// Arguments:
+// - heightmap: output
+// - map: block map of the chunk
+// - p, q: chunk position
+// Returns: none
+void heightmap_build(
+        Heightmap *heightmap,
+        const BlockMap *map,
+        int p,
+        int q)
+{
+    heightmap->x = p * CHUNK_SIZE;
+    heightmap->z = q * CHUNK_SIZE;
+    int top = BLOCK_MAP_HEIGHT - 1 + map->dy;
+    for (int dx = 0; dx < CHUNK_SIZE; dx++) {
+        for (int dz = 0; dz < CHUNK_SIZE; dz++) {
+            int x = heightmap->x + dx;
+            int z = heightmap->z + dz;
+            int i = HEIGHTMAP_INDEX(dx, dz);
+            heightmap->opaque[i] = column_top(map, x, z, top, is_opaque);
+            heightmap->obstacle[i] = column_top(map, x, z, top, is_obstacle);
+        }
+    }
+}
+
+
+// Update the top of a column after one of its blocks changed
+// Arguments:
+// - heightmap: heightmap of the chunk
+// - map: block map of the chunk, with the new block already set
+// - x, y, z: world position of the changed block (blocks outside of the
+//   chunk's own columns are ignored)
+// Returns: none
+void heightmap_update(
+        Heightmap *heightmap,
+        const BlockMap *map,
+        int x,
+        int y,
+        int z)
+{
+    int dx = x - heightmap->x;
+    int dz = z - heightmap->z;
+    if ((unsigned int)dx >= CHUNK_SIZE || (unsigned int)dz >= CHUNK_SIZE) {
+        return;
+    }
+    int i = HEIGHTMAP_INDEX(dx, dz);
+    int w = block_map_get(map, x, y, z);
+    if (is_opaque(w)) {
+        heightmap->opaque[i] = MAX(heightmap->opaque[i], y);
+    }
+    else if (heightmap->opaque[i] == y) {
+        heightmap->opaque[i] = column_top(map, x, z, y - 1, is_opaque);
+    }
+    if (is_obstacle(w)) {
+        heightmap->obstacle[i] = MAX(heightmap->obstacle[i], y);
+    }
+    else if (heightmap->obstacle[i] == y) {
+        heightmap->obstacle[i] = column_top(map, x, z, y - 1, is_obstacle);
+    }
+}
+
+
+// Get the y of the highest opaque block of a column
+// Arguments:
+// - heightmap: heightmap of the chunk
+// - x, z: world position of the column
+// Returns:
+// - y, or -1 if the column has no opaque block or is not in the chunk
+int heightmap_opaque(
+        const Heightmap *heightmap,
+        int x,
+        int z)
+{
+    int dx = x - heightmap->x;
+    int dz = z - heightmap->z;
+    if ((unsigned int)dx >= CHUNK_SIZE || (unsigned int)dz >= CHUNK_SIZE) {
+        return -1;
+    }
+    return heightmap->opaque[HEIGHTMAP_INDEX(dx, dz)];
+}
+
+
+// Get the y of the highest obstacle of a column
+// Arguments:
+// - heightmap: heightmap of the chunk
+// - x, z: world position of the column
+// Returns:
+// - y, or -1 if the column has no obstacle or is not in the chunk
+int heightmap_obstacle(
+        const Heightmap *heightmap,
+        int x,
+        int z)
+{
+    int dx = x - heightmap->x;
+    int dz = z - heightmap->z;
+    if ((unsigned int)dx >= CHUNK_SIZE || (unsigned int)dz >= CHUNK_SIZE) {
+        return -1;
+    }
+    return heightmap->obstacle[HEIGHTMAP_INDEX(dx, dz)];
+}
@@ -0,0 +1,46 @@
+#ifndef _heightmap_h_
+#define _heightmap_h_
+
+#include "blockmap.h"
+#include "config.h"
+
+// Index of a column of a chunk, from its position relative to the chunk
+#define HEIGHTMAP_INDEX(dx, dz) ((dx) * CHUNK_SIZE + (dz))
+
+// Top of each column of a chunk, made when the chunk is generated (see
+// heightmap_build()) and kept up to date as its blocks change (see
+// heightmap_update()).
+// - x, z: world position of the chunk's (0, 0) column
+// - opaque: y of the highest opaque block of each column, or -1
+// - obstacle: y of the highest obstacle of each column, or -1
+typedef struct {
+    int x;
+    int z;
+    short opaque[CHUNK_SIZE * CHUNK_SIZE];
+    short obstacle[CHUNK_SIZE * CHUNK_SIZE];
+} Heightmap;
+
+void heightmap_build(
+        Heightmap *heightmap,
+        const BlockMap *map,
+        int p,
+        int q);
+
+void heightmap_update(
+        Heightmap *heightmap,
+        const BlockMap *map,
+        int x,
+        int y,
+        int z);
+
+int heightmap_opaque(
+        const Heightmap *heightmap,
+        int x,
+        int z);
+
+int heightmap_obstacle(
+        const Heightmap *heightmap,
+        int x,
+        int z);
+
+#endif
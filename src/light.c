@@ -0,0 +1,176 @@
+#include <stdlib.h>
+#include "light.h"
+
+// This file contains the light propagation code.
+// It knows nothing about chunks: blocks are read and written through the
+// LightWorld callbacks, so only the blocks whose level changes are touched.
+
+static const int offsets[6][3] = {
+    {-1, 0, 0}, {1, 0, 0},
+    {0, -1, 0}, {0, 1, 0},
+    {0, 0, -1}, {0, 0, 1},
+};
+
+// Add a block to the end of a queue
+static void queue_push(LightQueue *queue, int x, int y, int z, int w) {
+    if (queue->end == queue->capacity) {
+        if (queue->start) {
+            // reuse the space before start
+            int size = queue->end - queue->start;
+            for (int i = 0; i < size; i++) {
+                queue->data[i] = queue->data[queue->start + i];
+            }
+            queue->start = 0;
+            queue->end = size;
+        }
+        if (queue->end == queue->capacity) {
+            queue->capacity = queue->capacity ? queue->capacity * 2 : 1024;
+            queue->data = (LightNode *)realloc(
+                queue->data, sizeof(LightNode) * queue->capacity);
+        }
+    }
+    LightNode *node = queue->data + queue->end++;
+    node->x = x;
+    node->y = y;
+    node->z = z;
+    node->w = w;
+}
+
+// Take the block at the front of a queue
+// Returns:
+// - non-zero if a block was taken, zero if the queue is empty
+static int queue_pop(LightQueue *queue, LightNode *node) {
+    if (queue->start == queue->end) {
+        queue->start = queue->end = 0;
+        return 0;
+    }
+    *node = queue->data[queue->start++];
+    return 1;
+}
+
+// Initialize a light engine with no queued changes
+void light_engine_init(LightEngine *engine, LightWorld world) {
+    engine->world = world;
+    engine->add.data = 0;
+    engine->add.start = engine->add.end = engine->add.capacity = 0;
+    engine->remove.data = 0;
+    engine->remove.start = engine->remove.end = engine->remove.capacity = 0;
+}
+
+// Free the queues of a light engine (but not the given engine pointer)
+void light_engine_free(LightEngine *engine) {
+    free(engine->add.data);
+    free(engine->remove.data);
+    engine->add.data = 0;
+    engine->remove.data = 0;
+}
+
+// Raise the level of a block to at least w and spread it.
+// This is used for light sources, which are lit even if they are opaque.
+void light_add(LightEngine *engine, int x, int y, int z, int w) {
+    LightWorld *world = &engine->world;
+    int level = world->get_level(world->arg, x, y, z);
+    if (level < 0 || level >= w) {
+        return;
+    }
+    world->set_level(world->arg, x, y, z, w);
+    queue_push(&engine->add, x, y, z, w);
+}
+
+// Darken a block and everything that it lit. Any light source at the block
+// is lit again afterwards, so this is also used when a source gets dimmer.
+void light_remove(LightEngine *engine, int x, int y, int z) {
+    LightWorld *world = &engine->world;
+    int level = world->get_level(world->arg, x, y, z);
+    if (level <= 0) {
+        return;
+    }
+    world->set_level(world->arg, x, y, z, 0);
+    queue_push(&engine->remove, x, y, z, level);
+    int source = world->get_source(world->arg, x, y, z);
+    if (source) {
+        light_add(engine, x, y, z, source);
+    }
+}
+
+// Spread the current light of a block to its neighbors again
+// (for example into a chunk that was just loaded next to it)
+void light_spread(LightEngine *engine, int x, int y, int z) {
+    LightWorld *world = &engine->world;
+    int level = world->get_level(world->arg, x, y, z);
+    if (level > 1) {
+        queue_push(&engine->add, x, y, z, level);
+    }
+}
+
+// Darken everything that a block with level w lit around it, without touching
+// the block itself. This is used for the border blocks of a chunk that is
+// being unloaded, before it is removed from the world.
+void light_forget(LightEngine *engine, int x, int y, int z, int w) {
+    if (w > 0) {
+        queue_push(&engine->remove, x, y, z, w);
+    }
+}
+
+// Update the light around a block that changed between opaque and not opaque
+void light_block_changed(LightEngine *engine, int x, int y, int z) {
+    LightWorld *world = &engine->world;
+    if (world->is_opaque(world->arg, x, y, z)) {
+        light_remove(engine, x, y, z);
+        return;
+    }
+    for (int i = 0; i < 6; i++) {
+        light_spread(engine,
+            x + offsets[i][0], y + offsets[i][1], z + offsets[i][2]);
+    }
+}
+
+// Apply all queued changes.
+// All removals are done first, because they can queue blocks to spread.
+void light_update(LightEngine *engine) {
+    LightWorld *world = &engine->world;
+    void *arg = world->arg;
+    LightNode node;
+    while (queue_pop(&engine->remove, &node)) {
+        for (int i = 0; i < 6; i++) {
+            int x = node.x + offsets[i][0];
+            int y = node.y + offsets[i][1];
+            int z = node.z + offsets[i][2];
+            int level = world->get_level(arg, x, y, z);
+            if (level <= 0) {
+                continue;
+            }
+            if (level < node.w) {
+                world->set_level(arg, x, y, z, 0);
+                queue_push(&engine->remove, x, y, z, level);
+                int source = world->get_source(arg, x, y, z);
+                if (source) {
+                    light_add(engine, x, y, z, source);
+                }
+            }
+            else {
+                queue_push(&engine->add, x, y, z, level);
+            }
+        }
+    }
+    while (queue_pop(&engine->add, &node)) {
+        int w = world->get_level(arg, node.x, node.y, node.z) - 1;
+        if (w <= 0) {
+            continue;
+        }
+        for (int i = 0; i < 6; i++) {
+            int x = node.x + offsets[i][0];
+            int y = node.y + offsets[i][1];
+            int z = node.z + offsets[i][2];
+            int level = world->get_level(arg, x, y, z);
+            if (level < 0 || level >= w) {
+                continue;
+            }
+            if (world->is_opaque(arg, x, y, z)) {
+                continue;
+            }
+            world->set_level(arg, x, y, z, w);
+            queue_push(&engine->add, x, y, z, w);
+        }
+    }
+}
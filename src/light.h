@@ -0,0 +1,60 @@
+#ifndef _light_h_
+#define _light_h_
+
+// Callbacks that the light engine uses to read and write the world
+// - arg: passed to every callback
+// - get_level: get the light level of a block, or -1 if it is not loaded
+// - set_level: set the light level of a loaded block
+// - get_source: get the intensity of the light source at a block (0 = none)
+// - is_opaque: non-zero if light does not pass into a block
+typedef struct {
+    void *arg;
+    int (*get_level)(void *arg, int x, int y, int z);
+    void (*set_level)(void *arg, int x, int y, int z, int w);
+    int (*get_source)(void *arg, int x, int y, int z);
+    int (*is_opaque)(void *arg, int x, int y, int z);
+} LightWorld;
+
+// A block waiting in a LightQueue, with the light level it had when queued
+typedef struct {
+    int x;
+    int y;
+    int z;
+    int w;
+} LightNode;
+
+// Growable FIFO queue of blocks
+typedef struct {
+    LightNode *data;
+    int start;
+    int end;
+    int capacity;
+} LightQueue;
+
+// Breadth-first light propagation.
+// The level of a block is the highest of the intensity of a light source at
+// the block and, for blocks that are not opaque, the level of its brightest
+// neighbor minus one. Sources are lit even when they are opaque.
+// Changes are queued with the functions below and applied by light_update().
+// Removed light is cleared with the usual two queue method: blocks that were
+// lit by the removed light are darkened, and the brighter blocks found around
+// them are queued to spread their light into the darkened area again.
+// - world: callbacks to access the world
+// - add: blocks whose light needs to be spread to their neighbors
+// - remove: darkened blocks whose neighbors may need to be darkened too
+typedef struct {
+    LightWorld world;
+    LightQueue add;
+    LightQueue remove;
+} LightEngine;
+
+void light_engine_init(LightEngine *engine, LightWorld world);
+void light_engine_free(LightEngine *engine);
+void light_add(LightEngine *engine, int x, int y, int z, int w);
+void light_remove(LightEngine *engine, int x, int y, int z);
+void light_spread(LightEngine *engine, int x, int y, int z);
+void light_forget(LightEngine *engine, int x, int y, int z, int w);
+void light_block_changed(LightEngine *engine, int x, int y, int z);
+void light_update(LightEngine *engine);
+
+#endif
@@ -332,6 +332,7 @@ main(
 
     // LOAD SHADERS //
     Attrib block_attrib = {0};
+    Attrib chunk_attrib = {0};
     Attrib line_attrib = {0};
     Attrib text_attrib = {0};
     Attrib sky_attrib = {0};
@@ -352,6 +353,21 @@ main(
     block_attrib.camera   = glGetUniformLocation(program, "camera");
     block_attrib.timer    = glGetUniformLocation(program, "timer");
 
+    program = load_program(
+        "shaders/chunk_vertex.glsl", "shaders/chunk_fragment.glsl");
+    chunk_attrib.program  = program;
+    chunk_attrib.position = glGetAttribLocation(program, "position");
+    chunk_attrib.uv       = glGetAttribLocation(program, "uv");
+    chunk_attrib.matrix   = glGetUniformLocation(program, "matrix");
+    chunk_attrib.sampler  = glGetUniformLocation(program, "sampler");
+    chunk_attrib.extra1   = glGetUniformLocation(program, "sky_sampler");
+    chunk_attrib.extra2   = glGetUniformLocation(program, "daylight");
+    chunk_attrib.extra3   = glGetUniformLocation(program, "fog_distance");
+    chunk_attrib.extra4   = glGetUniformLocation(program, "ortho");
+    chunk_attrib.extra5   = glGetUniformLocation(program, "origin");
+    chunk_attrib.camera   = glGetUniformLocation(program, "camera");
+    chunk_attrib.timer    = glGetUniformLocation(program, "timer");
+
     program = load_program(
         "shaders/line_vertex.glsl", "shaders/line_fragment.glsl");
     line_attrib.program  = program;
@@ -396,15 +412,13 @@ main(
     game->delete_radius = DELETE_CHUNK_RADIUS;
     game->sign_radius = RENDER_SIGN_RADIUS;
 
+    // The client always generates the default (unseeded) world
+    noise_init(&game->noise);
+
     // INITIALIZE WORKER THREADS
-    for (int i = 0; i < WORKERS; i++) {
-        Worker *worker = game->workers + i;
-        worker->index = i;
-        worker->state = WORKER_IDLE;
-        mtx_init(&worker->mtx, mtx_plain);
-        cnd_init(&worker->cnd);
-        thrd_create(&worker->thrd, worker_run, worker);
-    }
+    int worker_count = WORKERS ? WORKERS : get_cpu_count() - 1;
+    scheduler_start(&game->scheduler, worker_count, worker_run);
+    init_light(game);
 
 
     // OUTER LOOP //
@@ -426,6 +440,7 @@ main(
                 db_delete_all_signs();
             }
         }
+        load_world_generator(game);
 
         // CLIENT INITIALIZATION //
         if (game->mode == MODE_ONLINE) {
@@ -528,7 +543,8 @@ main(
             render_sky(game, &sky_attrib, player, sky_buffer);
             glClear(GL_DEPTH_BUFFER_BIT);
             // Get the face count while rendering for displaying the number on screen
-            int face_count = render_chunks(game, &block_attrib, player);
+            int face_count = render_chunks(
+                    game, &chunk_attrib, &block_attrib, player);
             render_signs(game, &text_attrib, player);
             render_sign(game, &text_attrib, player);
             render_players(game, &block_attrib, player);
@@ -567,6 +583,17 @@ main(
                     s->vx, s->vy, s->vz);
                 render_text(game, &text_attrib, ALIGN_LEFT, tx, ty, ts, text_buffer);
                 ty -= ts * 2;
+                if (get_db_enabled()) {
+                    RingStats stats;
+                    db_queue_stats(&stats);
+                    snprintf(
+                        text_buffer, 1024,
+                        "db queue: %d (max %d), %u stalls, %.0f ms",
+                        stats.size, stats.max_size, stats.stalls,
+                        stats.stall_time * 1000);
+                    render_text(game, &text_attrib, ALIGN_LEFT, tx, ty, ts, text_buffer);
+                    ty -= ts * 2;
+                }
             }
 
             /* Health debug text
@@ -647,6 +674,7 @@ main(
         // Shutdown of current game mode
         // (The outer game loop may or may not continue after this)
         db_save_state(s->x, s->y, s->z, s->rx, s->ry, me->attrs.flying);
+        wait_workers(game);
         db_close();
         db_disable();
         client_stop();
@@ -21,66 +21,181 @@ int hash(int x, int y, int z) {
     return x ^ y ^ z;
 }
 
+// Get the number of words of the occupancy bitmap of a table
+static unsigned int map_words(unsigned int mask) {
+    return (mask >> 5) + 1;
+}
+
+// Allocate a zeroed entry table and its occupancy bitmap for a map
+static void map_alloc_data(Map *map, unsigned int mask) {
+    map->mask = mask;
+    map->refs = (int *)malloc(sizeof(int));
+    *map->refs = 1;
+    map->data = (MapEntry *)calloc(
+        (mask + 1) + map_words(mask), sizeof(MapEntry));
+    map->used = (unsigned int *)(map->data + mask + 1);
+}
+
 void map_alloc(Map *map, int dx, int dy, int dz, int mask) {
     map->dx = dx;
     map->dy = dy;
     map->dz = dz;
-    map->mask = mask;
     map->size = 0;
-    map->data = (MapEntry *)calloc(map->mask + 1, sizeof(MapEntry));
+    map_alloc_data(map, mask);
 }
 
+// Release the map's reference to its data, freeing the data if it is not
+// shared with any other map.
 void map_free(Map *map) {
+    if (--(*map->refs)) {
+        return;
+    }
+    free(map->refs);
     free(map->data);
 }
 
+// Make dst a copy of src.
+// The copy shares its data with src until either map is modified.
 void map_copy(Map *dst, Map *src) {
-    dst->dx = src->dx;
-    dst->dy = src->dy;
-    dst->dz = src->dz;
-    dst->mask = src->mask;
-    dst->size = src->size;
-    dst->data = (MapEntry *)calloc(dst->mask + 1, sizeof(MapEntry));
-    memcpy(dst->data, src->data, (dst->mask + 1) * sizeof(MapEntry));
+    *dst = *src;
+    (*src->refs)++;
+}
+
+// Give the map a private copy of its data if the data is shared
+static void map_detach(Map *map) {
+    if (*map->refs == 1) {
+        return;
+    }
+    (*map->refs)--;
+    MapEntry *data = map->data;
+    map_alloc_data(map, map->mask);
+    memcpy(map->data, data,
+        ((map->mask + 1) + map_words(map->mask)) * sizeof(MapEntry));
+}
+
+// Get how far an entry is from the slot that its position hashes to
+static unsigned int map_distance(
+        const Map *map, const MapEntry *entry, unsigned int index)
+{
+    unsigned int home = hash(
+        entry->e.x + map->dx, entry->e.y + map->dy, entry->e.z + map->dz);
+    return (index - home) & map->mask;
+}
+
+// Insert an entry that is not in the map, starting at a slot that is
+// distance slots from its home slot. Entries closer to their home slot
+// than the inserted entry are moved further along.
+static void map_insert(
+        Map *map, MapEntry entry, unsigned int index, unsigned int distance)
+{
+    while (1) {
+        MapEntry *slot = map->data + index;
+        if (EMPTY_ENTRY(slot)) {
+            *slot = entry;
+            map->used[index >> 5] |= 1u << (index & 31);
+            return;
+        }
+        unsigned int other = map_distance(map, slot, index);
+        if (other < distance) {
+            MapEntry swap = *slot;
+            *slot = entry;
+            entry = swap;
+            distance = other;
+        }
+        index = (index + 1) & map->mask;
+        distance++;
+    }
+}
+
+// Remove the entry in a slot, shifting the entries after it back one slot
+// until one is in its home slot.
+static void map_remove(Map *map, unsigned int index) {
+    while (1) {
+        unsigned int next = (index + 1) & map->mask;
+        MapEntry *entry = map->data + next;
+        if (EMPTY_ENTRY(entry) || !map_distance(map, entry, next)) {
+            break;
+        }
+        map->data[index] = *entry;
+        index = next;
+    }
+    map->data[index].value = 0;
+    map->used[index >> 5] &= ~(1u << (index & 31));
+}
+
+// Move the entries of a map to a new table with the given mask
+static void map_resize(Map *map, unsigned int mask) {
+    Map old = *map;
+    map_alloc_data(map, mask);
+    for (unsigned int i = map_next(&old, 0); i <= old.mask;
+        i = map_next(&old, i + 1))
+    {
+        MapEntry entry = old.data[i];
+        unsigned int index = hash(
+            entry.e.x + old.dx, entry.e.y + old.dy, entry.e.z + old.dz) &
+            map->mask;
+        map_insert(map, entry, index, 0);
+    }
+    map_free(&old);
 }
 
 int map_set(Map *map, int x, int y, int z, int w) {
     unsigned int index = hash(x, y, z) & map->mask;
+    unsigned int distance = 0;
     x -= map->dx;
     y -= map->dy;
     z -= map->dz;
     MapEntry *entry = map->data + index;
-    int overwrite = 0;
+    int found = 0;
     while (!EMPTY_ENTRY(entry)) {
         if (entry->e.x == x && entry->e.y == y && entry->e.z == z) {
-            overwrite = 1;
+            found = 1;
+            break;
+        }
+        if (map_distance(map, entry, index) < distance) {
             break;
         }
         index = (index + 1) & map->mask;
         entry = map->data + index;
+        distance++;
     }
-    if (overwrite) {
-        if (entry->e.w != w) {
+    if (found) {
+        if (entry->e.w == w) {
+            return 0;
+        }
+        map_detach(map);
+        entry = map->data + index;
+        if (w) {
             entry->e.w = w;
             return 1;
         }
-    }
-    else if (w) {
-        entry->e.x = x;
-        entry->e.y = y;
-        entry->e.z = z;
-        entry->e.w = w;
-        map->size++;
-        if (map->size * 2 > map->mask) {
-            map_grow(map);
+        map_remove(map, index);
+        map->size--;
+        if (map->size * 8 < map->mask + 1 && map->mask > MAP_MIN_MASK) {
+            map_resize(map, map->mask >> 1);
         }
         return 1;
     }
-    return 0;
+    if (!w) {
+        return 0;
+    }
+    map_detach(map);
+    MapEntry added;
+    added.e.x = x;
+    added.e.y = y;
+    added.e.z = z;
+    added.e.w = w;
+    map_insert(map, added, index, distance);
+    map->size++;
+    if (map->size * 2 > map->mask) {
+        map_grow(map);
+    }
+    return 1;
 }
 
 int map_get(Map *map, int x, int y, int z) {
     unsigned int index = hash(x, y, z) & map->mask;
+    unsigned int distance = 0;
     x -= map->dx;
     y -= map->dy;
     z -= map->dz;
@@ -92,26 +207,19 @@ int map_get(Map *map, int x, int y, int z) {
         if (entry->e.x == x && entry->e.y == y && entry->e.z == z) {
             return entry->e.w;
         }
+        // a Robin Hood table keeps the entry before any entry that is
+        // closer to its home slot
+        if (map_distance(map, entry, index) < distance) {
+            return 0;
+        }
         index = (index + 1) & map->mask;
         entry = map->data + index;
+        distance++;
     }
     return 0;
 }
 
+// Double the size of a map's table
 void map_grow(Map *map) {
-    Map new_map;
-    new_map.dx = map->dx;
-    new_map.dy = map->dy;
-    new_map.dz = map->dz;
-    new_map.mask = (map->mask << 1) | 1;
-    new_map.size = 0;
-    new_map.data = (MapEntry *)calloc(new_map.mask + 1, sizeof(MapEntry));
-    MAP_FOR_EACH(map, ex, ey, ez, ew) {
-        map_set(&new_map, ex, ey, ez, ew);
-    } END_MAP_FOR_EACH;
-    free(map->data);
-    map->mask = new_map.mask;
-    map->size = new_map.size;
-    map->data = new_map.data;
+    map_resize(map, (map->mask << 1) | 1);
 }
-
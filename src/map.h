@@ -3,15 +3,34 @@
 
 #define EMPTY_ENTRY(entry) ((entry)->value == 0)
 
+// Smallest table that a map shrinks to
+#define MAP_MIN_MASK 0xf
+
+// Index of the lowest set bit of a non-zero word
+#if defined(__GNUC__)
+    #define MAP_CTZ(bits) __builtin_ctz(bits)
+#else
+static inline int map_ctz(unsigned int bits) {
+    int result = 0;
+    while (!(bits & 1)) {
+        bits >>= 1;
+        result++;
+    }
+    return result;
+}
+    #define MAP_CTZ(bits) map_ctz(bits)
+#endif
+
+// Iterate over the entries of a map. Only the words of the occupancy bitmap
+// are scanned (see map_next()), so a mostly empty table is cheap to walk. The
+// map must not be modified in the body.
 #define MAP_FOR_EACH(map, ex, ey, ez, ew) \
-    for (unsigned int i = 0; i <= map->mask; i++) { \
-        MapEntry *entry = map->data + i; \
-        if (EMPTY_ENTRY(entry)) { \
-            continue; \
-        } \
-        int ex = entry->e.x + map->dx; \
-        int ey = entry->e.y + map->dy; \
-        int ez = entry->e.z + map->dz; \
+    for (unsigned int i = map_next(map, 0); i <= (map)->mask; \
+            i = map_next(map, i + 1)) { \
+        MapEntry *entry = (map)->data + i; \
+        int ex = entry->e.x + (map)->dx; \
+        int ey = entry->e.y + (map)->dy; \
+        int ez = entry->e.z + (map)->dz; \
         int ew = entry->e.w;
 
 #define END_MAP_FOR_EACH }
@@ -34,15 +53,47 @@ typedef union {
     } e;
 } MapEntry;
 
+// Hash map of block positions to values.
+// It is an open addressing table with Robin Hood linear probing: an entry
+// that is further from its home slot takes the place of one that is closer
+// to its own, so that lookups can stop early. Setting a value to 0 removes
+// the entry (shifting the entries after it back), and the table shrinks when
+// it becomes sparse. Entries never have w == 0.
+// Copies made with map_copy() share the entry table with the original until
+// one of them is modified (copy-on-write). The reference count is not atomic,
+// so maps sharing a table must be copied, modified and freed on one thread.
+// - used: occupancy bitmap, one bit per slot of data (in the same
+//   allocation as data)
 typedef struct {
     int dx;
     int dy;
     int dz;
     unsigned int mask;
     unsigned int size;
+    int *refs;       // number of maps sharing data
     MapEntry *data;
+    unsigned int *used;
 } Map;
 
+// Find the first used slot of a map at or after an index
+// Returns:
+// - index of the slot, or mask + 1 if there is none
+static inline unsigned int map_next(const Map *map, unsigned int index) {
+    unsigned int words = (map->mask >> 5) + 1;
+    unsigned int word = index >> 5;
+    if (word >= words) {
+        return map->mask + 1;
+    }
+    unsigned int bits = map->used[word] & (~0u << (index & 31));
+    while (!bits) {
+        if (++word >= words) {
+            return map->mask + 1;
+        }
+        bits = map->used[word];
+    }
+    return (word << 5) + MAP_CTZ(bits);
+}
+
 void map_alloc(Map *map, int dx, int dy, int dz, int mask);
 void map_free(Map *map);
 void map_copy(Map *dst, Map *src);
@@ -0,0 +1,949 @@
+#include "mesh.h"
+#include "blockmap.h"
+#include "config.h"
+#include "cube.h"
+#include "item.h"
+#include "noise.h"
+#include "util.h"
+#include "world.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MESH_SSE2
+#include <emmintrin.h>
+#endif
+
+// This file contains the chunk mesher. It only reads the block and light maps
+// given in a WorkerItem and writes vertex data, so it does not need OpenGL or
+// the game model and can be run by the worker threads and by the benchmark
+// (see bench/).
+
+
+// Neighbors of each face corner, as indices into the 3x3x3 block
+// neighborhood ((dx + 1) * 9 + (dy + 1) * 3 + dz + 1): the corner and the
+// two sides that occlude it, and the 4 blocks whose shade and light it gets.
+static const int lookup3[6][4][3] = {
+    {{0, 1, 3}, {2, 1, 5}, {6, 3, 7}, {8, 5, 7}},
+    {{18, 19, 21}, {20, 19, 23}, {24, 21, 25}, {26, 23, 25}},
+    {{6, 7, 15}, {8, 7, 17}, {24, 15, 25}, {26, 17, 25}},
+    {{0, 1, 9}, {2, 1, 11}, {18, 9, 19}, {20, 11, 19}},
+    {{0, 3, 9}, {6, 3, 15}, {18, 9, 21}, {24, 15, 21}},
+    {{2, 5, 11}, {8, 5, 17}, {20, 11, 23}, {26, 17, 23}}
+};
+static const int lookup4[6][4][4] = {
+    {{0, 1, 3, 4}, {1, 2, 4, 5}, {3, 4, 6, 7}, {4, 5, 7, 8}},
+    {{18, 19, 21, 22}, {19, 20, 22, 23}, {21, 22, 24, 25}, {22, 23, 25, 26}},
+    {{6, 7, 15, 16}, {7, 8, 16, 17}, {15, 16, 24, 25}, {16, 17, 25, 26}},
+    {{0, 1, 9, 10}, {1, 2, 10, 11}, {9, 10, 18, 19}, {10, 11, 19, 20}},
+    {{0, 3, 9, 12}, {3, 6, 12, 15}, {9, 12, 18, 21}, {12, 15, 21, 24}},
+    {{2, 5, 11, 14}, {5, 8, 14, 17}, {11, 14, 20, 23}, {14, 17, 23, 26}}
+};
+
+
+// Arguments:
+// - neighbors
+// - lights
+// - shades
+// - ao
+// - light
+// Returns: none
+void occlusion(
+        char neighbors[27],
+        char lights[27],
+        float shades[27],
+        float ao[6][4],
+        float light[6][4])
+{
+    static const float curve[4] = {0.0, 0.25, 0.5, 0.75};
+    for (int i = 0; i < 6; i++) {
+        for (int j = 0; j < 4; j++) {
+            int corner = neighbors[lookup3[i][j][0]];
+            int side1 = neighbors[lookup3[i][j][1]];
+            int side2 = neighbors[lookup3[i][j][2]];
+            int value = side1 && side2 ? 3 : corner + side1 + side2;
+            float shade_sum = 0;
+            float light_sum = 0;
+            int is_light = lights[13] == 15;
+            for (int k = 0; k < 4; k++) {
+                shade_sum += shades[lookup4[i][j][k]];
+                light_sum += lights[lookup4[i][j][k]];
+            }
+            if (is_light) {
+                light_sum = 15 * 4 * 10;
+            }
+            float total = curve[value] + shade_sum / 4.0;
+            ao[i][j] = MIN(total, 1.0);
+            light[i][j] = light_sum / 15.0 / 4.0;
+        }
+    }
+}
+
+
+// The volumes cover a chunk and its apron, the one block border that faces,
+// ambient occlusion and light levels depend on. That is the area of the
+// chunk's block map, so the blocks of the neighbors are not needed.
+#define XZ_SIZE BLOCK_MAP_WIDTH
+#define Y_SIZE 258
+#define VOLUME (XZ_SIZE * XZ_SIZE * Y_SIZE)
+#define XYZ(x, y, z) ((y) * XZ_SIZE * XZ_SIZE + (x) * XZ_SIZE + (z))
+#define XZ(x, z) ((x) * XZ_SIZE + (z))
+#define GREEDY_VOLUME (CHUNK_SIZE * CHUNK_SIZE * CHUNK_MESH_HEIGHT)
+#define GREEDY_INDEX(x, y, z) (((y) * CHUNK_SIZE + (x)) * CHUNK_SIZE + (z))
+
+// Column masks have one bit per block of a column, from y = 0 up, in
+// COLUMN_WORDS words. The opacity masks cover the columns of the volumes,
+// the other masks only the chunk.
+#define COLUMN_WORDS (BLOCK_MAP_HEIGHT / 64)
+#define MASK_COLUMN(x, z) (XZ(x, z) * COLUMN_WORDS)
+#define CHUNK_COLUMN(x, z) (((x) * CHUNK_SIZE + (z)) * COLUMN_WORDS)
+#define CHUNK_COLUMNS (CHUNK_SIZE * CHUNK_SIZE)
+
+// Number of face corners of a block (6 faces of 4 corners)
+#define CORNERS 24
+
+#if defined(__GNUC__)
+    #define POPCOUNT64(bits) __builtin_popcountll(bits)
+    #define CTZ64(bits) __builtin_ctzll(bits)
+    #define CLZ64(bits) __builtin_clzll(bits)
+#else
+static int popcount64(uint64_t bits) {
+    int result = 0;
+    for (; bits; bits &= bits - 1) {
+        result++;
+    }
+    return result;
+}
+static int ctz64(uint64_t bits) {
+    int result = 0;
+    for (; !(bits & 1); bits >>= 1) {
+        result++;
+    }
+    return result;
+}
+static int clz64(uint64_t bits) {
+    int result = 0;
+    for (; !(bits >> 63); bits <<= 1) {
+        result++;
+    }
+    return result;
+}
+    #define POPCOUNT64(bits) popcount64(bits)
+    #define CTZ64(bits) ctz64(bits)
+    #define CLZ64(bits) clz64(bits)
+#endif
+
+
+// Get the bits of word j of a column mask that are in [y0, y1]
+static uint64_t column_range(int j, int y0, int y1) {
+    int lo = MAX(y0 - j * 64, 0);
+    int hi = MIN(y1 - j * 64, 63);
+    if (lo > hi) {
+        return 0;
+    }
+    return (~(uint64_t)0 << lo) & (~(uint64_t)0 >> (63 - hi));
+}
+
+
+// Find the exposed faces of every block of a chunk a column at a time, by
+// masking the chunk's blocks with the shifted opacity of their neighbors.
+// Arguments:
+// - opaque: opacity masks of the chunk and its border (MASK_COLUMN())
+// - own: masks of the chunk's blocks that get faces (CHUNK_COLUMN())
+// - faces: output, 6 masks per column of the blocks whose face in that
+//   direction is exposed (in the face order of make_cube_quads())
+// - exposed: output, masks of the blocks with any exposed face
+// - layers: output, mask of the y levels with any exposed block
+// Returns: none
+static void column_faces(
+        const uint64_t *opaque,
+        const uint64_t *own,
+        uint64_t *faces,
+        uint64_t *exposed,
+        uint64_t layers[COLUMN_WORDS])
+{
+    for (int j = 0; j < COLUMN_WORDS; j++) {
+        layers[j] = 0;
+    }
+    for (int x = 0; x < CHUNK_SIZE; x++) {
+        for (int z = 0; z < CHUNK_SIZE; z++) {
+            const uint64_t *o = opaque + MASK_COLUMN(x + 1, z + 1);
+            const uint64_t *x0 = opaque + MASK_COLUMN(x, z + 1);
+            const uint64_t *x1 = opaque + MASK_COLUMN(x + 2, z + 1);
+            const uint64_t *z0 = opaque + MASK_COLUMN(x + 1, z);
+            const uint64_t *z1 = opaque + MASK_COLUMN(x + 1, z + 2);
+            int column = CHUNK_COLUMN(x, z);
+            uint64_t *f = faces + column * 6;
+            for (int j = 0; j < COLUMN_WORDS; j++) {
+                uint64_t blocks = own[column + j];
+                if (!blocks) {
+                    for (int k = 0; k < 6; k++) {
+                        f[k * COLUMN_WORDS + j] = 0;
+                    }
+                    exposed[column + j] = 0;
+                    continue;
+                }
+                uint64_t above = o[j] >> 1;
+                uint64_t below = o[j] << 1;
+                if (j + 1 < COLUMN_WORDS) {
+                    above |= o[j + 1] << 63;
+                }
+                if (j > 0) {
+                    below |= o[j - 1] >> 63;
+                }
+                else {
+                    below |= 1;  // the bottom of the world is never shown
+                }
+                uint64_t any = 0;
+                any |= f[0 * COLUMN_WORDS + j] = blocks & ~x0[j];
+                any |= f[1 * COLUMN_WORDS + j] = blocks & ~x1[j];
+                any |= f[2 * COLUMN_WORDS + j] = blocks & ~above;
+                any |= f[3 * COLUMN_WORDS + j] = blocks & ~below;
+                any |= f[4 * COLUMN_WORDS + j] = blocks & ~z0[j];
+                any |= f[5 * COLUMN_WORDS + j] = blocks & ~z1[j];
+                exposed[column + j] = any;
+                layers[j] |= any;
+            }
+        }
+    }
+}
+
+
+// Get the key that greedy meshing uses to merge a block face.
+// Faces with equal keys look the same, so they can be drawn as one quad.
+// Arguments:
+// - ao: ambient occlusion at the corners of the face (from occlusion())
+// - light: light at the corners of the face (from occlusion())
+// - tile: texture tile of the face
+// Returns:
+// - key, or 0 if the corners differ and the face can not be merged
+int greedy_key(
+        const float ao[4],
+        const float light[4],
+        int tile)
+{
+    for (int i = 1; i < 4; i++) {
+        if (ao[i] != ao[0] || light[i] != light[0]) {
+            return 0;
+        }
+    }
+    // ao is a multiple of 1/32 and light is a sum of 4 light levels / 60
+    // (see occlusion())
+    int ao32 = (int)(ao[0] * 32 + 0.5);
+    int light_sum = (int)(light[0] * 60 + 0.5);
+    return (tile + 1) | (ao32 << 9) | (light_sum << 15);
+}
+
+
+// Merge the faces in a greedy meshing mask into as few quads as possible and
+// generate them. The mask is left all zero.
+// Arguments:
+// - mask: 6 face directions of GREEDY_VOLUME face keys (see greedy_key())
+// - data: output vertex data
+// Returns:
+// - number of faces generated
+int greedy_mesh(
+        int *mask,
+        ChunkVertex *data)
+{
+    static const int size[3] = {CHUNK_SIZE, CHUNK_MESH_HEIGHT, CHUNK_SIZE};
+    static const int stride[3] = {
+        GREEDY_INDEX(1, 0, 0), GREEDY_INDEX(0, 1, 0), GREEDY_INDEX(0, 0, 1)
+    };
+    // axis of each face direction, and the two axes that faces merge along
+    static const int axes[6][3] = {
+        {0, 1, 2}, {0, 1, 2},
+        {1, 0, 2}, {1, 0, 2},
+        {2, 1, 0}, {2, 1, 0}
+    };
+    int faces = 0;
+    for (int f = 0; f < 6; f++) {
+        int *m = mask + f * GREEDY_VOLUME;
+        int n = axes[f][0];
+        int a = axes[f][1];
+        int b = axes[f][2];
+        for (int i = 0; i < size[n]; i++) {
+            for (int j = 0; j < size[a]; j++) {
+                for (int k = 0; k < size[b]; k++) {
+                    int index = i * stride[n] + j * stride[a] + k * stride[b];
+                    int key = m[index];
+                    if (!key) {
+                        continue;
+                    }
+                    // widen along b, then extend along a while the whole
+                    // row matches
+                    int w = 1;
+                    while (k + w < size[b] && m[index + w * stride[b]] == key) {
+                        w++;
+                    }
+                    int h = 1;
+                    while (j + h < size[a]) {
+                        int row = index + h * stride[a];
+                        int l = 0;
+                        while (l < w && m[row + l * stride[b]] == key) {
+                            l++;
+                        }
+                        if (l < w) {
+                            break;
+                        }
+                        h++;
+                    }
+                    for (int dj = 0; dj < h; dj++) {
+                        for (int dk = 0; dk < w; dk++) {
+                            m[index + dj * stride[a] + dk * stride[b]] = 0;
+                        }
+                    }
+                    int start[3];
+                    int count[3];
+                    start[n] = i;
+                    start[a] = j;
+                    start[b] = k;
+                    count[n] = 1;
+                    count[a] = h;
+                    count[b] = w;
+                    int tile = (key & 511) - 1;
+                    float ao = ((key >> 9) & 63) / 32.0;
+                    float light = (key >> 15) / 15.0 / 4.0;
+                    const float aos[4] = {ao, ao, ao, ao};
+                    const float lights[4] = {light, light, light, light};
+                    make_chunk_quad(
+                            data + faces * 4, aos, lights, f, tile,
+                            start[0], start[1], start[2],
+                            count[0], count[1], count[2]);
+                    faces++;
+                }
+            }
+        }
+    }
+    return faces;
+}
+
+
+// Clear the slabs [y0, y1] of a scratch volume
+// Arguments:
+// - volume: opaque or light volume of a ChunkScratch
+// - y0, y1: range of volume y coordinates to clear
+// Returns: none
+void clear_chunk_scratch(
+        char *volume,
+        int y0,
+        int y1)
+{
+    if (y0 <= y1) {
+        memset(volume + XYZ(0, y0, 0), 0, (y1 - y0 + 1) * XZ_SIZE * XZ_SIZE);
+    }
+}
+
+
+// Fill the shade volume in [y0, y1] by sweeping all columns down from the
+// top a plane at a time. A block is shaded by the nearest opaque block at
+// most 7 blocks above it (or itself), in steps of 1/8: 8 for an opaque
+// block, 7 for one below it, and so on down to 0.
+// Arguments:
+// - opaque: opaque volume
+// - highest: highest opaque y of each column of the opaque volume
+// - shade: output shade volume
+// - y0: lowest volume y to fill
+// - y1: highest volume y to fill
+// Returns: none
+static void sweep_shade(
+        const char *opaque,
+        const char *highest,
+        char *shade,
+        int y0,
+        int y1)
+{
+    // distance of each column to the nearest opaque block above, up to 8
+    unsigned char distance[XZ_SIZE][XZ_SIZE];
+    memset(distance, 8, sizeof(distance));
+    for (int y = MIN(y1 + 7, Y_SIZE - 1); y >= y0; y--) {
+        for (int x = 0; x < XZ_SIZE; x++) {
+            const char *o = opaque + XYZ(x, y, 0);
+            unsigned char *d = distance[x];
+            for (int z = 0; z < XZ_SIZE; z++) {
+                d[z] = o[z] ? 0 : MIN(d[z] + 1, 8);
+            }
+            if (y > y1) {
+                continue;
+            }
+            const char *h = highest + XZ(x, 0);
+            char *s = shade + XYZ(x, y, 0);
+            for (int z = 0; z < XZ_SIZE; z++) {
+                s[z] = y > h[z] ? 0 : 8 - d[z];
+            }
+        }
+    }
+}
+
+
+// Get the ambient occlusion and light of the face corners of a row of
+// blocks along z, the same as occlusion() but with integers: ao is in
+// 1/32 steps and light is the sum of the 4 light levels.
+// Arguments:
+// - opaque: opaque volume
+// - shade: shade volume (see sweep_shade())
+// - light: light volume, or 0 if there are no lights
+// - x: volume x of the row
+// - y: volume y of the row
+// - ao: output ao of each corner (face * 4 + corner) of the row's blocks
+// - light_sum: output light of each corner of the row's blocks
+// Returns: none
+static void row_occlusion(
+        const char *opaque,
+        const char *shade,
+        const char *light,
+        int x,
+        int y,
+        unsigned char ao[CORNERS][CHUNK_SIZE],
+        unsigned char light_sum[CORNERS][CHUNK_SIZE])
+{
+    // rows start at the neighbors of the first block of the row
+    const char *opaque_row = opaque + XYZ(x, y, 1);
+    const char *shade_row = shade + XYZ(x, y, 1);
+    const char *light_row = light ? light + XYZ(x, y, 1) : 0;
+    int volume_offset[27];
+    for (int n = 0; n < 27; n++) {
+        int dx = n / 9 - 1;
+        int dy = n / 3 % 3 - 1;
+        int dz = n % 3 - 1;
+        volume_offset[n] = XYZ(dx, dy, dz);
+    }
+    for (int k = 0; k < CORNERS; k++) {
+        const int *l3 = lookup3[k / 4][k % 4];
+        const int *l4 = lookup4[k / 4][k % 4];
+        const char *corner = opaque_row + volume_offset[l3[0]];
+        const char *side1 = opaque_row + volume_offset[l3[1]];
+        const char *side2 = opaque_row + volume_offset[l3[2]];
+        const char *shades[4];
+        const char *lights[4];
+        for (int i = 0; i < 4; i++) {
+            shades[i] = shade_row + volume_offset[l4[i]];
+            lights[i] = light_row ? light_row + volume_offset[l4[i]] : 0;
+        }
+#ifdef MESH_SSE2
+        const __m128i max_ao = _mm_set1_epi8(32);
+        for (int z = 0; z < CHUNK_SIZE; z += 16) {
+            #define LOAD(p) _mm_loadu_si128((const __m128i *)((p) + z))
+            __m128i s1 = LOAD(side1);
+            __m128i s2 = LOAD(side2);
+            // both sides occlude fully, otherwise each of the 3 blocks does
+            __m128i value = _mm_add_epi8(
+                _mm_or_si128(LOAD(corner), _mm_and_si128(s1, s2)),
+                _mm_add_epi8(s1, s2));
+            value = _mm_add_epi8(value, value);
+            value = _mm_add_epi8(value, value);
+            value = _mm_add_epi8(value, value);
+            __m128i sum = _mm_add_epi8(
+                _mm_add_epi8(LOAD(shades[0]), LOAD(shades[1])),
+                _mm_add_epi8(LOAD(shades[2]), LOAD(shades[3])));
+            _mm_storeu_si128((__m128i *)(ao[k] + z),
+                _mm_min_epu8(_mm_add_epi8(value, sum), max_ao));
+            if (light_row) {
+                sum = _mm_add_epi8(
+                    _mm_add_epi8(LOAD(lights[0]), LOAD(lights[1])),
+                    _mm_add_epi8(LOAD(lights[2]), LOAD(lights[3])));
+                _mm_storeu_si128((__m128i *)(light_sum[k] + z), sum);
+            }
+            #undef LOAD
+        }
+#else
+        for (int z = 0; z < CHUNK_SIZE; z++) {
+            int s1 = side1[z];
+            int s2 = side2[z];
+            int value = s1 && s2 ? 3 : corner[z] + s1 + s2;
+            int sum = shades[0][z] + shades[1][z] + shades[2][z] +
+                shades[3][z];
+            ao[k][z] = MIN(value * 8 + sum, 32);
+            if (light_row) {
+                light_sum[k][z] = lights[0][z] + lights[1][z] +
+                    lights[2][z] + lights[3][z];
+            }
+        }
+#endif
+        if (!light_row) {
+            memset(light_sum[k], 0, CHUNK_SIZE);
+        }
+    }
+}
+
+
+// Copy the non-zero cells of a block map that fall in the apron volume of a
+// chunk, which the maps of the neighbors only overlap at their edges
+// Arguments:
+// - map
+// - s0: first section to copy
+// - s1: section after the last section to copy
+// - ox: x of volume x 0
+// - oz: z of volume z 0
+// - volume: output volume
+// Returns: none
+static void fill_apron(
+        const BlockMap *map,
+        int s0,
+        int s1,
+        int ox,
+        int oz,
+        char *volume)
+{
+    int x0 = MAX(ox - map->dx, 0);
+    int z0 = MAX(oz - map->dz, 0);
+    int x1 = MIN(ox + XZ_SIZE - map->dx, BLOCK_MAP_WIDTH);
+    int z1 = MIN(oz + XZ_SIZE - map->dz, BLOCK_MAP_WIDTH);
+    for (int s = s0; s < s1; s++) {
+        const BlockSection *section = map->sections[s];
+        if (!section->count) {
+            continue;
+        }
+        for (int y = 0; y < BLOCK_SECTION_HEIGHT; y++) {
+            int vy = s * BLOCK_SECTION_HEIGHT + y + map->dy + 1;
+            for (int x = x0; x < x1; x++) {
+                for (int z = z0; z < z1; z++) {
+                    int w = block_section_get(
+                        section, BLOCK_SECTION_INDEX(x, y, z));
+                    if (w) {
+                        volume[XYZ(x + map->dx - ox, vy, z + map->dz - oz)] = w;
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+// Get the number of bytes that a ChunkScratch has allocated
+// Arguments:
+// - scratch
+// Returns:
+// - size in bytes (0 until the scratch has been used by compute_chunk())
+int chunk_scratch_memory(
+        const ChunkScratch *scratch)
+{
+    if (!scratch->opaque) {
+        return 0;
+    }
+    return VOLUME * 3 + XZ_SIZE * XZ_SIZE + 6 * GREEDY_VOLUME * sizeof(int) +
+        (XZ_SIZE * XZ_SIZE + CHUNK_COLUMNS * 9) * COLUMN_WORDS *
+        sizeof(uint64_t);
+}
+
+
+// Free the memory of a ChunkScratch
+// Arguments:
+// - scratch
+// Returns: none
+void free_chunk_scratch(
+        ChunkScratch *scratch)
+{
+    free(scratch->opaque);
+    free(scratch->light);
+    free(scratch->highest);
+    free(scratch->shade);
+    free(scratch->greedy);
+    free(scratch->opaque_bits);
+    free(scratch->own_bits);
+    free(scratch->plant_bits);
+    free(scratch->face_bits);
+    free(scratch->exposed_bits);
+    memset(scratch, 0, sizeof(ChunkScratch));
+}
+
+
+// Generate the vertex data for the mesh sections of a chunk
+// Arguments:
+// - item: worker item with the block and light maps of the chunk and its
+//   neighbors, and the mesh sections to generate (item->sections)
+// - scratch: memory for the opaque, light and highest volumes, which is all
+//   zero before and after the call
+// Returns: none
+void compute_chunk(
+        WorkerItem *item,
+        ChunkScratch *scratch)
+{
+    int lo = BLOCK_MAP_HEIGHT;
+    int hi = -1;
+    for (int i = 0; i < CHUNK_MESH_SECTIONS; i++) {
+        item->meshes[i].faces = 0;
+        item->meshes[i].plant_faces = 0;
+        item->meshes[i].data = 0;
+        item->meshes[i].plant_data = 0;
+        if (item->sections & (1 << i)) {
+            lo = MIN(lo, i * CHUNK_MESH_HEIGHT);
+            hi = MAX(hi, i * CHUNK_MESH_HEIGHT + CHUNK_MESH_HEIGHT - 1);
+        }
+    }
+    if (hi < 0) {
+        return;
+    }
+
+    // Faces depend on blocks at most 1 block away, shading on blocks at most
+    // 9 blocks above and light on blocks less than 15 blocks away, so only
+    // the blocks in [y0, y1] can change the generated sections.
+    int y0 = MAX(lo - 16, 0);
+    int y1 = MIN(hi + 16, BLOCK_MAP_HEIGHT - 1);
+    int s0 = y0 / BLOCK_SECTION_HEIGHT;
+    int s1 = y1 / BLOCK_SECTION_HEIGHT + 1;
+
+    if (!scratch->opaque) {
+        scratch->opaque = calloc(VOLUME, sizeof(char));
+        scratch->light = calloc(VOLUME, sizeof(char));
+        scratch->highest = calloc(XZ_SIZE * XZ_SIZE, sizeof(char));
+        scratch->shade = calloc(VOLUME, sizeof(char));
+        scratch->greedy = calloc(6 * GREEDY_VOLUME, sizeof(int));
+        scratch->opaque_bits = calloc(
+            XZ_SIZE * XZ_SIZE * COLUMN_WORDS, sizeof(uint64_t));
+        scratch->own_bits = calloc(
+            CHUNK_COLUMNS * COLUMN_WORDS, sizeof(uint64_t));
+        scratch->plant_bits = calloc(
+            CHUNK_COLUMNS * COLUMN_WORDS, sizeof(uint64_t));
+        scratch->face_bits = calloc(
+            CHUNK_COLUMNS * 6 * COLUMN_WORDS, sizeof(uint64_t));
+        scratch->exposed_bits = calloc(
+            CHUNK_COLUMNS * COLUMN_WORDS, sizeof(uint64_t));
+    }
+    char *opaque = scratch->opaque;
+    char *light = scratch->light;
+    char *highest = scratch->highest;
+    char *shade = scratch->shade;
+    int *greedy = scratch->greedy;
+    uint64_t *opaque_bits = scratch->opaque_bits;
+    uint64_t *own_bits = scratch->own_bits;
+    uint64_t *plant_bits = scratch->plant_bits;
+    uint64_t *face_bits = scratch->face_bits;
+    uint64_t *exposed_bits = scratch->exposed_bits;
+
+    int ox = item->p * CHUNK_SIZE - 1;
+    int oy = -1;
+    int oz = item->q * CHUNK_SIZE - 1;
+
+
+    // check for lights
+    int has_light = 0;
+    if (SHOW_LIGHTS) {
+        for (int a = 0; a < 3; a++) {
+            for (int b = 0; b < 3; b++) {
+                BlockMap *map = item->level_maps[a][b];
+                if (map && block_map_size(map)) {
+                    has_light = 1;
+                }
+            }
+        }
+    }
+
+    // populate opaque array from the chunk's blocks and apron
+    BlockMap *map = item->block_map;
+    BLOCK_MAP_FOR_EACH_IN_SECTIONS(map, s0, s1, ex, ey, ez, ew) {
+        int x = ex - ox;
+        int y = ey - oy;
+        int z = ez - oz;
+        int w = ew;
+        opaque[XYZ(x, y, z)] = !is_transparent(w);
+        if (!opaque[XYZ(x, y, z)]) {
+            continue;
+        }
+        highest[XZ(x, z)] = MAX(highest[XZ(x, z)], y);
+        opaque_bits[MASK_COLUMN(x, z) + ey / 64] |= (uint64_t)1 << (ey & 63);
+    } END_BLOCK_MAP_FOR_EACH;
+
+    // mark the chunk's own blocks, which get faces
+    for (int s = s0; s < s1; s++) {
+        const BlockSection *section = map->sections[s];
+        if (!section->count) {
+            continue;
+        }
+        for (int y = 0; y < BLOCK_SECTION_HEIGHT; y++) {
+            int ey = s * BLOCK_SECTION_HEIGHT + y;
+            uint64_t bit = (uint64_t)1 << (ey & 63);
+            for (int x = 0; x < CHUNK_SIZE; x++) {
+                for (int z = 0; z < CHUNK_SIZE; z++) {
+                    int w = block_section_get(
+                        section, BLOCK_SECTION_INDEX(x + 1, y, z + 1));
+                    if (w <= 0) {
+                        continue;
+                    }
+                    int column = CHUNK_COLUMN(x, z) + ey / 64;
+                    own_bits[column] |= bit;
+                    if (is_plant(w)) {
+                        plant_bits[column] |= bit;
+                    }
+                }
+            }
+        }
+    }
+
+    // copy the light levels of the chunk and the edges of its neighbors
+    if (has_light) {
+        for (int a = 0; a < 3; a++) {
+            for (int b = 0; b < 3; b++) {
+                BlockMap *level_map = item->level_maps[a][b];
+                if (level_map) {
+                    fill_apron(level_map, s0, s1, ox, oz, light);
+                }
+            }
+        }
+    }
+
+    // shade the rows of the generated sections and the rows next to them
+    sweep_shade(opaque, highest, shade, lo, MIN(hi + 2, Y_SIZE - 1));
+
+    // find the exposed faces of whole columns at once
+    uint64_t layers[COLUMN_WORDS];
+    column_faces(opaque_bits, own_bits, face_bits, exposed_bits, layers);
+
+    // count exposed faces
+    int total_faces = 0;
+    int total_plant_faces = 0;
+    for (int i = 0; i < CHUNK_MESH_SECTIONS; i++) {
+        if (!(item->sections & (1 << i))) {
+            continue;
+        }
+        int start = i * CHUNK_MESH_HEIGHT;
+        int end = start + CHUNK_MESH_HEIGHT - 1;
+        int miny = 256;
+        int maxy = 0;
+        int faces = 0;
+        int plant_faces = 0;
+        for (int j = 0; j < COLUMN_WORDS; j++) {
+            uint64_t range = column_range(j, start, end) & layers[j];
+            if (!range) {
+                continue;
+            }
+            miny = MIN(miny, j * 64 + CTZ64(range));
+            maxy = MAX(maxy, j * 64 + 63 - CLZ64(range));
+            for (int column = j; column < CHUNK_COLUMNS * COLUMN_WORDS;
+                column += COLUMN_WORDS)
+            {
+                uint64_t any = exposed_bits[column] & range;
+                if (!any) {
+                    continue;
+                }
+                uint64_t plants = plant_bits[column];
+                const uint64_t *f = face_bits + (column - j) * 6 + j;
+                for (int k = 0; k < 6; k++) {
+                    faces += POPCOUNT64(f[k * COLUMN_WORDS] & range & ~plants);
+                }
+                plant_faces += POPCOUNT64(any & plants) * 4;
+            }
+        }
+        WorkerMesh *mesh = item->meshes + i;
+        mesh->miny = miny;
+        mesh->maxy = maxy;
+        total_faces += faces;
+        total_plant_faces += plant_faces;
+    }
+
+    // the vertex data of all sections goes into the item's buffers, which
+    // are kept with the item and only grow (greedy meshing only makes the
+    // sections smaller than counted here)
+    if (total_faces > item->capacity) {
+        free(item->data);
+        item->data = malloc(sizeof(ChunkVertex) * 4 * total_faces);
+        item->capacity = total_faces;
+    }
+    if (total_plant_faces > item->plant_capacity) {
+        free(item->plant_data);
+        item->plant_data = malloc(sizeof(GLfloat) * 6 * 10 * total_plant_faces);
+        item->plant_capacity = total_plant_faces;
+    }
+
+    // generate geometry
+    unsigned char row_ao[CORNERS][CHUNK_SIZE];
+    unsigned char row_light[CORNERS][CHUNK_SIZE];
+    ChunkVertex *data = item->data;
+    GLfloat *plant_data = item->plant_data;
+    int offset = 0;
+    int plant_offset = 0;
+    for (int i = 0; i < CHUNK_MESH_SECTIONS; i++) {
+        if (!(item->sections & (1 << i))) {
+            continue;
+        }
+        int first = offset;
+        int first_plant = plant_offset;
+        int mx = item->p * CHUNK_SIZE;
+        int my = i * CHUNK_MESH_HEIGHT;
+        int mz = item->q * CHUNK_SIZE;
+        WorkerMesh *mesh = item->meshes + i;
+        mesh->data = data + offset * 4;
+        mesh->plant_data = plant_data + plant_offset * 60;
+        // visit the exposed blocks in the order of BLOCK_MAP_FOR_EACH, which
+        // keeps the vertex data the same as walking the whole map
+        for (int ey = my; ey < my + CHUNK_MESH_HEIGHT; ey++) {
+            uint64_t bit = (uint64_t)1 << (ey & 63);
+            if (!(layers[ey / 64] & bit)) {
+                continue;
+            }
+            const BlockSection *section =
+                map->sections[ey / BLOCK_SECTION_HEIGHT];
+            for (int dx = 0; dx < CHUNK_SIZE; dx++) {
+                int row_ready = 0;
+                for (int dz = 0; dz < CHUNK_SIZE; dz++) {
+                    int column = CHUNK_COLUMN(dx, dz) + ey / 64;
+                    if (!(exposed_bits[column] & bit)) {
+                        continue;
+                    }
+                    const uint64_t *f =
+                        face_bits + (column - ey / 64) * 6 + ey / 64;
+                    int f1 = (f[0 * COLUMN_WORDS] & bit) != 0;
+                    int f2 = (f[1 * COLUMN_WORDS] & bit) != 0;
+                    int f3 = (f[2 * COLUMN_WORDS] & bit) != 0;
+                    int f4 = (f[3 * COLUMN_WORDS] & bit) != 0;
+                    int f5 = (f[4 * COLUMN_WORDS] & bit) != 0;
+                    int f6 = (f[5 * COLUMN_WORDS] & bit) != 0;
+                    int total = f1 + f2 + f3 + f4 + f5 + f6;
+                    int ew = block_section_get(section, BLOCK_SECTION_INDEX(
+                            dx + 1, ey % BLOCK_SECTION_HEIGHT, dz + 1));
+                    int ex = mx + dx;
+                    int ez = mz + dz;
+                    int x = ex - ox;
+                    int y = ey - oy;
+                    int z = ez - oz;
+                    if (!row_ready) {
+                        row_occlusion(opaque, shade, has_light ? light : 0,
+                            x, y, row_ao, row_light);
+                        row_ready = 1;
+                    }
+                    // a block that is a full light source lights all of its
+                    // corners
+                    int is_light = has_light && light[XYZ(x, y, z)] == 15;
+                    float ao[6][4];
+                    float light[6][4];
+                    for (int k = 0; k < CORNERS; k++) {
+                        int light_sum =
+                            is_light ? 15 * 4 * 10 : row_light[k][dz];
+                        ao[k / 4][k % 4] = row_ao[k][dz] / 32.0;
+                        light[k / 4][k % 4] = light_sum / 15.0 / 4.0;
+                    }
+                    if (is_plant(ew)) {
+                        float min_ao = 1;
+                        float max_light = 0;
+                        for (int a = 0; a < 6; a++) {
+                            for (int b = 0; b < 4; b++) {
+                                min_ao = MIN(min_ao, ao[a][b]);
+                                max_light = MAX(max_light, light[a][b]);
+                            }
+                        }
+                        float rotation = noise_simplex2(
+                                item->noise, ex, ez, 4, 0.5, 2) * 360;
+                        make_plant(
+                                plant_data + plant_offset * 60,
+                                min_ao, max_light,
+                                ex, ey, ez, 0.5, ew, rotation);
+                        plant_offset += 4;
+                    }
+                    else {
+                        int visible[6] = {f1, f2, f3, f4, f5, f6};
+                        if (GREEDY_MESHING) {
+                            // faces with the same ao and light at every
+                            // corner are merged with their neighbors by
+                            // greedy_mesh() instead
+                            int index = GREEDY_INDEX(
+                                    ex - mx, ey - my, ez - mz);
+                            for (int f = 0; f < 6; f++) {
+                                int key = 0;
+                                if (visible[f]) {
+                                    key = greedy_key(
+                                        ao[f], light[f], blocks[ew][f]);
+                                }
+                                if (key) {
+                                    greedy[f * GREEDY_VOLUME + index] = key;
+                                    visible[f] = 0;
+                                    total--;
+                                }
+                            }
+                        }
+                        make_cube_quads(
+                                data + offset * 4, ao, light, visible,
+                                ex - mx, ey - my, ez - mz, ew);
+                        offset += total;
+                    }
+                }
+            }
+        }
+        if (GREEDY_MESHING) {
+            offset += greedy_mesh(greedy, data + offset * 4);
+        }
+        mesh->faces = offset - first;
+        mesh->plant_faces = plant_offset - first_plant;
+    }
+
+    // leave the scratch volumes zeroed for the next call
+    int clear0 = s0 * BLOCK_SECTION_HEIGHT - oy;
+    int clear1 = s1 * BLOCK_SECTION_HEIGHT - 1 - oy;
+    clear_chunk_scratch(opaque, clear0, clear1);
+    if (has_light) {
+        clear_chunk_scratch(light, clear0, clear1);
+    }
+    memset(highest, 0, XZ_SIZE * XZ_SIZE);
+    memset(opaque_bits, 0, XZ_SIZE * XZ_SIZE * COLUMN_WORDS * sizeof(uint64_t));
+    memset(own_bits, 0, CHUNK_COLUMNS * COLUMN_WORDS * sizeof(uint64_t));
+    memset(plant_bits, 0, CHUNK_COLUMNS * COLUMN_WORDS * sizeof(uint64_t));
+}
+
+
+// Generate the vertex data for the clouds above a chunk (see create_clouds()).
+// Faces between the clouds of neighboring columns are skipped, and each
+// cloud side that is not covered is a single tall quad.
+// Arguments:
+// - p: chunk p location
+// - q: chunk q location
+// - context: noise of the world seed
+// - data: output vertex data with room for CLOUD_MAX_FACES faces, with y
+//   relative to CLOUD_MIN_Y
+// Returns:
+// - number of faces generated
+int compute_clouds(
+        int p,
+        int q,
+        const NoiseContext *context,
+        ChunkVertex *data)
+{
+    static const float ao[4] = {0};
+    static const float light[4] = {0};
+    // face direction of each side and the offset of its neighbor column
+    static const int sides[4][3] = {{0, -1, 0}, {1, 1, 0}, {4, 0, -1}, {5, 0, 1}};
+    int bottom[WORLD_COLUMNS];
+    int top[WORLD_COLUMNS];
+    create_clouds(p, q, context, bottom, top);
+    int faces = 0;
+    for (int x = 0; x < CHUNK_SIZE; x++) {
+        for (int z = 0; z < CHUNK_SIZE; z++) {
+            int n = (x + WORLD_PAD) * WORLD_WIDTH + (z + WORLD_PAD);
+            int y0 = bottom[n];
+            int y1 = top[n];
+            if (y0 == y1) {
+                continue;
+            }
+            int y = y0 - CLOUD_MIN_Y;
+            for (int face = 2; face <= 3; face++) {
+                make_chunk_quad(data + faces++ * 4, ao, light, face,
+                        blocks[CLOUD][face], x, y, z, 1, y1 - y0, 1);
+            }
+            for (int i = 0; i < 4; i++) {
+                int face = sides[i][0];
+                int m = n + sides[i][1] * WORLD_WIDTH + sides[i][2];
+                // the neighbor covers [bottom[m], top[m]) of this side, so
+                // the parts below and above it are visible
+                int spans[2][2] = {
+                    {y0, MIN(y1, bottom[m])},
+                    {MAX(y0, top[m]), y1}
+                };
+                if (bottom[m] == top[m]) {
+                    spans[0][1] = y1;
+                    spans[1][0] = y1;
+                }
+                for (int j = 0; j < 2; j++) {
+                    int a = spans[j][0];
+                    int b = spans[j][1];
+                    if (a >= b) {
+                        continue;
+                    }
+                    make_chunk_quad(data + faces++ * 4, ao, light, face,
+                            blocks[CLOUD][face], x, a - CLOUD_MIN_Y, z,
+                            1, b - a, 1);
+                }
+            }
+        }
+    }
+    return faces;
+}
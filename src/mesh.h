@@ -0,0 +1,59 @@
+#ifndef _mesh_h_
+#define _mesh_h_
+
+
+#include "Worker.h"
+
+
+// Most faces that compute_clouds() generates: a top, a bottom and 2 parts of
+// each side for every column
+#define CLOUD_MAX_FACES (CHUNK_SIZE * CHUNK_SIZE * 10)
+
+
+void
+clear_chunk_scratch(
+        char *volume,
+        int y0,
+        int y1);
+
+int
+chunk_scratch_memory(
+        const ChunkScratch *scratch);
+
+void
+compute_chunk(
+        WorkerItem *item,
+        ChunkScratch *scratch);
+
+int
+compute_clouds(
+        int p,
+        int q,
+        const NoiseContext *context,
+        ChunkVertex *data);
+
+void
+free_chunk_scratch(
+        ChunkScratch *scratch);
+
+int
+greedy_key(
+        const float ao[4],
+        const float light[4],
+        int tile);
+
+int
+greedy_mesh(
+        int *mask,
+        ChunkVertex *data);
+
+void
+occlusion(
+        char neighbors[27],
+        char lights[27],
+        float shades[27],
+        float ao[6][4],
+        float light[6][4]);
+
+
+#endif /*_mesh_h_*/
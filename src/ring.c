@@ -1,21 +1,68 @@
+#include "ring.h"
 #include <stdlib.h>
 #include <string.h>
-#include "ring.h"
+#include <time.h>
 
 // Ring data structure for setting up a sequence of tasks for workers to do to
 // the world database.
+// The ring is a bounded queue that producers put to and the consumer gets from
+// without locks. Every cell has a sequence number that tells which position
+// the cell is ready for: a producer claims position n by moving end from n to
+// n + 1 once the cell of n has sequence n, writes its entry and sets the
+// sequence to n + 1. The consumer takes the entry of position n once the
+// sequence is n + 1 and sets it to n + capacity, which frees the cell for the
+// next round. The mutex is only taken to sleep, by the consumer when the ring
+// is empty and by producers when it is full, and to wake them up.
+
+#define ATOMIC_LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define ATOMIC_ADD(p, v) __atomic_add_fetch(p, v, __ATOMIC_RELAXED)
+#define ATOMIC_CAS(p, expected, v) __atomic_compare_exchange_n( \
+    p, expected, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#define ATOMIC_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+
+static double ring_time(void) {
+    struct timespec ts;
+#if defined(CLOCK_MONOTONIC)
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#elif defined(CLOCK_REALTIME)
+    clock_gettime(CLOCK_REALTIME, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 
-// Allocate ring with a set initial capacity (which can grow)
+// Allocate a ring with a fixed capacity
 // Arguments:
 // - ring: pointer to ring structure to modify
-// - capacity: initial capacity for ring entries
+// - capacity: number of entries the ring can hold, rounded up to a power of
+//   two
 // Returns:
 // - modifies the structure that ring points to
 void ring_alloc(Ring *ring, int capacity) {
-    ring->capacity = capacity;
-    ring->start = 0;
+    unsigned int size = 2;
+    while (size < (unsigned int)capacity) {
+        size <<= 1;
+    }
+    ring->capacity = size;
+    ring->cells = (RingCell *)calloc(size, sizeof(RingCell));
+    for (unsigned int i = 0; i < size; i++) {
+        ring->cells[i].sequence = i;
+    }
     ring->end = 0;
-    ring->data = (RingEntry *)calloc(capacity, sizeof(RingEntry));
+    ring->start = 0;
+    ring->waiting = 0;
+    ring->stalled = 0;
+    mtx_init(&ring->mtx, mtx_plain);
+    cnd_init(&ring->cnd);
+    cnd_init(&ring->room);
+    ring->puts = 0;
+    ring->max_size = 0;
+    ring->stalls = 0;
+    ring->stall_time = 0;
 }
 
 // Free the ring's data (but does not free the given ring pointer).
@@ -23,7 +70,10 @@ void ring_alloc(Ring *ring, int capacity) {
 // - ring: pointer to ring structure
 // Returns: none
 void ring_free(Ring *ring) {
-    free(ring->data);
+    cnd_destroy(&ring->room);
+    cnd_destroy(&ring->cnd);
+    mtx_destroy(&ring->mtx);
+    free(ring->cells);
 }
 
 // Predicate function for if the ring is empty
@@ -32,72 +82,155 @@ void ring_free(Ring *ring) {
 // Returns:
 // - returns non-zero if ring is empty
 int ring_empty(Ring *ring) {
-    return ring->start == ring->end;
+    return ring_size(ring) == 0;
 }
 
-// Predicate function for if the ring is full
+// Get the ring's number of current entries. While producers are putting
+// entries this counts the entries that are being written.
 // Arguments:
 // - ring: pointer to ring structure
 // Returns:
-// - returns non-zero if ring is full
-int ring_full(Ring *ring) {
-    return ring->start == (ring->end + 1) % ring->capacity;
+// - returns the number of entries
+int ring_size(Ring *ring) {
+    unsigned int start = ATOMIC_LOAD(&ring->start);
+    unsigned int end = ATOMIC_LOAD(&ring->end);
+    return (int)(end - start);
 }
 
-// Get the ring's number of current entries
+// Try to put an entry into the ring without waiting
+// Returns:
+// - returns 0 if the ring is full
+static int ring_try_put(Ring *ring, RingEntry *entry) {
+    unsigned int mask = ring->capacity - 1;
+    unsigned int end = __atomic_load_n(&ring->end, __ATOMIC_RELAXED);
+    while (1) {
+        RingCell *cell = ring->cells + (end & mask);
+        int diff = (int)(ATOMIC_LOAD(&cell->sequence) - end);
+        if (diff == 0) {
+            if (ATOMIC_CAS(&ring->end, &end, end + 1)) {
+                memcpy(&cell->entry, entry, sizeof(RingEntry));
+                ATOMIC_STORE(&cell->sequence, end + 1);
+                return 1;
+            }
+        }
+        else if (diff < 0) {
+            return 0;
+        }
+        else {
+            end = __atomic_load_n(&ring->end, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Put an entry into the ring. If the ring is full this waits until the
+// consumer has taken entries, so the producer is held back instead of the
+// ring growing.
 // Arguments:
-// - ring: pointer to ring structure
+// - ring: pointer to ring structure to modify
+// - entry: entry to copy into the ring
 // Returns:
-// - returns the number of entries
-int ring_size(Ring *ring) {
-    if (ring->end >= ring->start) {
-        return ring->end - ring->start;
+// - modifies the structure that ring points to
+void ring_put(Ring *ring, RingEntry *entry) {
+    if (!ring_try_put(ring, entry)) {
+        ATOMIC_ADD(&ring->stalls, 1);
+        double start = ring_time();
+        mtx_lock(&ring->mtx);
+        ATOMIC_ADD(&ring->stalled, 1);
+        ATOMIC_FENCE();
+        while (!ring_try_put(ring, entry)) {
+            cnd_wait(&ring->room, &ring->mtx);
+        }
+        ATOMIC_ADD(&ring->stalled, -1);
+        ring->stall_time += ring_time() - start;
+        mtx_unlock(&ring->mtx);
     }
-    else {
-        return ring->capacity - (ring->start - ring->end);
+    ATOMIC_ADD(&ring->puts, 1);
+    // the entry must be visible before waiting is read, as ring_wait() sets
+    // waiting before it looks for entries
+    ATOMIC_FENCE();
+    if (ATOMIC_LOAD(&ring->waiting)) {
+        mtx_lock(&ring->mtx);
+        cnd_signal(&ring->cnd);
+        mtx_unlock(&ring->mtx);
     }
 }
 
-// Grow the ring's memory space for ring entries.
-// Note: this function is mutually recursive with ring_put
+// Retrieves and removes the next RingEntry from the ring and copies it to the
+// entry argument. Only the consumer thread may call this.
 // Arguments:
 // - ring: pointer to ring structure to modify
 // Returns:
+// - returns 0 if an entry was not retrieved
+// - returns 1 if an entry was retrieved
 // - modifies the structure that ring points to
-void ring_grow(Ring *ring) {
-    Ring new_ring;
-    RingEntry entry;
-    // Create a new ring with double the capacity
-    ring_alloc(&new_ring, ring->capacity * 2);
-    // Copy the entries from the old ring to the new
-    while (ring_get(ring, &entry)) {
-        ring_put(&new_ring, &entry);
+int ring_get(Ring *ring, RingEntry *entry) {
+    unsigned int start = ring->start;
+    RingCell *cell = ring->cells + (start & (ring->capacity - 1));
+    if (ATOMIC_LOAD(&cell->sequence) != start + 1) {
+        return 0;
     }
-    // Free the old ring's data
-    free(ring->data);
-    // Make the old ring have the new ring's values
-    ring->capacity = new_ring.capacity;
-    ring->start = new_ring.start;
-    ring->end = new_ring.end;
-    ring->data = new_ring.data;
+    memcpy(entry, &cell->entry, sizeof(RingEntry));
+    ATOMIC_STORE(&cell->sequence, start + ring->capacity);
+    ATOMIC_STORE(&ring->start, start + 1);
+    return 1;
 }
 
-// Put an entry into the ring.
-// Note: this function is mutually recursive with ring_grow
+// Take the next entries from the ring, waiting until there is at least one.
+// Only the consumer thread may call this.
 // Arguments:
 // - ring: pointer to ring structure to modify
+// - entries: output entries
+// - count: most entries to take
 // Returns:
-// - modifies the structure that ring points to
-void ring_put(Ring *ring, RingEntry *entry) {
-    // Ensure there is room for a new entry
-    if (ring_full(ring)) {
-        ring_grow(ring);
+// - number of entries taken
+int ring_wait(Ring *ring, RingEntry *entries, int count) {
+    unsigned int size = ring_size(ring);
+    if (size > ring->max_size) {
+        ATOMIC_STORE(&ring->max_size, size);
+    }
+    int n = 0;
+    while (n < count && ring_get(ring, entries + n)) {
+        n++;
+    }
+    if (!n) {
+        mtx_lock(&ring->mtx);
+        ATOMIC_STORE(&ring->waiting, 1);
+        ATOMIC_FENCE();
+        while (n < count && ring_get(ring, entries + n)) {
+            n++;
+        }
+        while (!n) {
+            cnd_wait(&ring->cnd, &ring->mtx);
+            while (n < count && ring_get(ring, entries + n)) {
+                n++;
+            }
+        }
+        ATOMIC_STORE(&ring->waiting, 0);
+        mtx_unlock(&ring->mtx);
     }
-    // Copy the new entry to the end of the ring
-    RingEntry *e = ring->data + ring->end;
-    memcpy(e, entry, sizeof(RingEntry));
-    // Increment the end pointer
-    ring->end = (ring->end + 1) % ring->capacity;
+    // wake up the producers that wait for room
+    ATOMIC_FENCE();
+    if (ATOMIC_LOAD(&ring->stalled)) {
+        mtx_lock(&ring->mtx);
+        cnd_broadcast(&ring->room);
+        mtx_unlock(&ring->mtx);
+    }
+    return n;
+}
+
+// Get the counters of a ring
+// Arguments:
+// - ring: pointer to ring structure
+// - stats: output counters
+// Returns: none
+void ring_stats(Ring *ring, RingStats *stats) {
+    stats->size = ring_size(ring);
+    stats->max_size = ATOMIC_LOAD(&ring->max_size);
+    stats->puts = ATOMIC_LOAD(&ring->puts);
+    stats->stalls = ATOMIC_LOAD(&ring->stalls);
+    mtx_lock(&ring->mtx);
+    stats->stall_time = ring->stall_time;
+    mtx_unlock(&ring->mtx);
 }
 
 // Put a block entry into the ring.
@@ -185,25 +318,6 @@ void ring_put_exit(Ring *ring) {
     ring_put(ring, &entry);
 }
 
-// Retrieves and removes the next RingEntry from the ring and copies it to the
-// entry argument.
-// Arguments:
-// - ring: pointer to ring structure to modify
-// Returns:
-// - returns 0 if an entry was not retrieved
-// - returns 1 if an entry was retrieved
-// - modifies the structure that ring points to
-int ring_get(Ring *ring, RingEntry *entry) {
-    if (ring_empty(ring)) {
-        return 0;
-    }
-    RingEntry *e = ring->data + ring->start;
-    memcpy(entry, e, sizeof(RingEntry));
-    ring->start = (ring->start + 1) % ring->capacity;
-    return 1;
-}
-
-
 void ring_put_block_damage(Ring *ring, int p, int q, int x, int y, int z, int damage) {
     RingEntry entry;
     entry.type = BLOCK_DAMAGE;
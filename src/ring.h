@@ -1,6 +1,7 @@
 #ifndef _ring_h_
 #define _ring_h_
 
+#include <tinycthread.h>
 
 typedef enum {
     BLOCK,
@@ -25,14 +26,55 @@ typedef struct {
 } RingEntry;
 
 
+// A slot of the ring: an entry and the position it is ready for (see ring.c)
+typedef struct {
+    unsigned int sequence;
+    RingEntry entry;
+} RingCell;
+
+
+// Bounded lock-free queue of entries with any number of producer threads and
+// one consumer thread. A producer that finds the ring full waits for room.
+// - capacity: number of cells, a power of two
+// - cells: storage for the entries
+// - end: next position to put to, shared by the producers
+// - start: next position to get from, used by the consumer
+// - waiting: non-zero while the consumer sleeps in ring_wait()
+// - stalled: number of producers waiting for room
+// - mtx: mutex for sleeping and waking up, and for stall_time
+// - cnd: condition signalled when an entry is put for a waiting consumer
+// - room: condition signalled when entries are taken for stalled producers
+// - puts: number of entries put
+// - max_size: most entries that the consumer has found in the ring
+// - stalls: number of times that a producer waited for room
+// - stall_time: seconds that producers waited for room
 typedef struct {
     unsigned int capacity;
-    unsigned int start;
+    RingCell *cells;
     unsigned int end;
-    RingEntry *data;
+    unsigned int start;
+    int waiting;
+    int stalled;
+    mtx_t mtx;
+    cnd_t cnd;
+    cnd_t room;
+    unsigned int puts;
+    unsigned int max_size;
+    unsigned int stalls;
+    double stall_time;
 } Ring;
 
 
+// Counters of a ring (see ring_stats())
+typedef struct {
+    int size;
+    int max_size;
+    unsigned int puts;
+    unsigned int stalls;
+    double stall_time;
+} RingStats;
+
+
 void ring_alloc(
         Ring *ring,
         int capacity);
@@ -43,16 +85,10 @@ int ring_empty(
 void ring_free(
         Ring *ring);
 
-int ring_full(
-        Ring *ring);
-
 int ring_get(
         Ring *ring,
         RingEntry *entry);
 
-void ring_grow(
-        Ring *ring);
-
 void ring_put(
         Ring *ring,
         RingEntry *entry);
@@ -104,5 +140,14 @@ void ring_put_light(
 int ring_size(
         Ring *ring);
 
+void ring_stats(
+        Ring *ring,
+        RingStats *stats);
+
+int ring_wait(
+        Ring *ring,
+        RingEntry *entries,
+        int count);
+
 
 #endif
@@ -0,0 +1,180 @@
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <unistd.h>
+#endif
+
+#include "scheduler.h"
+
+// This file contains the worker thread pool that builds chunks.
+// Every worker has its own queue, and the main thread spreads submitted items
+// over the queues. A worker whose queue is empty steals from the front of the
+// other queues, so no worker sits idle while there is work left to do.
+
+// Get the number of processors available to this program
+// Returns:
+// - number of processors (at least 1)
+int get_cpu_count(void) {
+    int result;
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    result = info.dwNumberOfProcessors;
+#else
+    result = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return result > 0 ? result : 1;
+}
+
+// Take the item at the front of a worker's queue
+// Returns:
+// - the item, or NULL if the queue is empty
+static WorkerItem *worker_take(Worker *worker) {
+    WorkerItem *item = NULL;
+    mtx_lock(&worker->mtx);
+    if (worker->queue_size) {
+        item = worker->queue[worker->queue_start];
+        worker->queue_start = (worker->queue_start + 1) % MAX_WORKER_ITEMS;
+        worker->queue_size--;
+    }
+    mtx_unlock(&worker->mtx);
+    return item;
+}
+
+// Worker thread function
+static int worker_run(void *arg) {
+    Worker *worker = (Worker *)arg;
+    Scheduler *scheduler = worker->scheduler;
+    while (1) {
+        // Reserve one of the queued items
+        mtx_lock(&scheduler->mtx);
+        while (!scheduler->queued) {
+            cnd_wait(&scheduler->cnd, &scheduler->mtx);
+        }
+        scheduler->queued--;
+        mtx_unlock(&scheduler->mtx);
+        // Find it, starting with this worker's own queue
+        WorkerItem *item = NULL;
+        while (!item) {
+            for (int i = 0; i < scheduler->worker_count && !item; i++) {
+                int index = (worker->index + i) % scheduler->worker_count;
+                item = worker_take(scheduler->workers + index);
+            }
+        }
+        scheduler->func(worker, item);
+        mtx_lock(&scheduler->mtx);
+        scheduler->done[scheduler->done_count++] = item;
+        mtx_unlock(&scheduler->mtx);
+    }
+    return 0;
+}
+
+// Start the worker threads
+// Arguments:
+// - scheduler: scheduler to initialize
+// - worker_count: number of worker threads, clamped to [1, MAX_WORKERS]
+// - func: function that the workers call for each submitted item
+// Returns: none
+void scheduler_start(
+        Scheduler *scheduler,
+        int worker_count,
+        worker_func func)
+{
+    worker_count = worker_count < 1 ? 1 : worker_count;
+    worker_count = worker_count > MAX_WORKERS ? MAX_WORKERS : worker_count;
+    scheduler->worker_count = worker_count;
+    scheduler->func = func;
+    mtx_init(&scheduler->mtx, mtx_plain);
+    cnd_init(&scheduler->cnd);
+    scheduler->queued = 0;
+    scheduler->done_count = 0;
+    scheduler->item_limit = worker_count * JOBS_PER_WORKER;
+    scheduler->free_count = 0;
+    for (int i = 0; i < scheduler->item_limit; i++) {
+        scheduler->free_items[scheduler->free_count++] = scheduler->items + i;
+    }
+    scheduler->next_worker = 0;
+    scheduler->next_id = 0;
+    for (int i = 0; i < worker_count; i++) {
+        Worker *worker = scheduler->workers + i;
+        worker->index = i;
+        worker->queue_start = 0;
+        worker->queue_size = 0;
+        worker->scheduler = scheduler;
+        mtx_init(&worker->mtx, mtx_plain);
+    }
+    for (int i = 0; i < worker_count; i++) {
+        Worker *worker = scheduler->workers + i;
+        thrd_create(&worker->thrd, worker_run, worker);
+    }
+}
+
+// Get an unused item to fill in and submit
+// Returns:
+// - item with a new id, or NULL if the limit of items in use is reached
+WorkerItem *scheduler_alloc_item(
+        Scheduler *scheduler)
+{
+    if (!scheduler->free_count) {
+        return NULL;
+    }
+    WorkerItem *item = scheduler->free_items[--scheduler->free_count];
+    item->id = ++scheduler->next_id;
+    return item;
+}
+
+// Return a collected (or never submitted) item to the unused items
+void scheduler_free_item(
+        Scheduler *scheduler,
+        WorkerItem *item)
+{
+    scheduler->free_items[scheduler->free_count++] = item;
+}
+
+// Queue an item to be worked on.
+// Items are started roughly in the order they are submitted.
+void scheduler_submit(
+        Scheduler *scheduler,
+        WorkerItem *item)
+{
+    Worker *worker = scheduler->workers + scheduler->next_worker;
+    scheduler->next_worker =
+        (scheduler->next_worker + 1) % scheduler->worker_count;
+    mtx_lock(&worker->mtx);
+    int index = (worker->queue_start + worker->queue_size) % MAX_WORKER_ITEMS;
+    worker->queue[index] = item;
+    worker->queue_size++;
+    mtx_unlock(&worker->mtx);
+    mtx_lock(&scheduler->mtx);
+    scheduler->queued++;
+    cnd_signal(&scheduler->cnd);
+    mtx_unlock(&scheduler->mtx);
+}
+
+// Get items that the workers have finished
+// Arguments:
+// - scheduler
+// - items: output array for the finished items
+// - max_items: size of the items array
+// Returns:
+// - number of items written to the items array
+int scheduler_collect(
+        Scheduler *scheduler,
+        WorkerItem **items,
+        int max_items)
+{
+    int count = 0;
+    mtx_lock(&scheduler->mtx);
+    while (scheduler->done_count && count < max_items) {
+        items[count++] = scheduler->done[--scheduler->done_count];
+    }
+    mtx_unlock(&scheduler->mtx);
+    return count;
+}
+
+// Get the number of items that are submitted but not collected yet
+int scheduler_busy(
+        Scheduler *scheduler)
+{
+    return scheduler->item_limit - scheduler->free_count;
+}
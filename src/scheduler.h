@@ -0,0 +1,72 @@
+#ifndef _scheduler_h_
+#define _scheduler_h_
+
+#include <tinycthread.h>
+#include "Worker.h"
+
+// Function that a worker thread calls to work on an item
+typedef void (*worker_func)(Worker *worker, WorkerItem *item);
+
+// Pool of worker threads with work stealing.
+// The main thread allocates items, submits them in priority order and then
+// collects them once they are done. Only the queues, queued, done and
+// done_count are shared with the worker threads; everything else belongs to
+// the main thread.
+// - workers: worker threads
+// - worker_count: number of running worker threads
+// - func: function that works on an item
+// - mtx: mutex for queued, done and done_count
+// - cnd: condition signalled when an item is submitted
+// - queued: number of submitted items that no worker has reserved yet
+// - done: items that are finished and waiting to be collected
+// - done_count: number of items in done
+// - items: storage for all items
+// - free_items: items that are not in use
+// - free_count: number of items in free_items
+// - item_limit: maximum number of items in use at once
+// - next_worker: worker whose queue gets the next submitted item
+// - next_id: id for the next allocated item
+typedef struct Scheduler {
+    Worker workers[MAX_WORKERS];
+    int worker_count;
+    worker_func func;
+    mtx_t mtx;
+    cnd_t cnd;
+    int queued;
+    WorkerItem *done[MAX_WORKER_ITEMS];
+    int done_count;
+    WorkerItem items[MAX_WORKER_ITEMS];
+    WorkerItem *free_items[MAX_WORKER_ITEMS];
+    int free_count;
+    int item_limit;
+    int next_worker;
+    int next_id;
+} Scheduler;
+
+int get_cpu_count(void);
+
+void scheduler_start(
+        Scheduler *scheduler,
+        int worker_count,
+        worker_func func);
+
+WorkerItem *scheduler_alloc_item(
+        Scheduler *scheduler);
+
+void scheduler_free_item(
+        Scheduler *scheduler,
+        WorkerItem *item);
+
+void scheduler_submit(
+        Scheduler *scheduler,
+        WorkerItem *item);
+
+int scheduler_collect(
+        Scheduler *scheduler,
+        WorkerItem **items,
+        int max_items);
+
+int scheduler_busy(
+        Scheduler *scheduler);
+
+#endif
@@ -71,7 +71,7 @@ char *load_file(const char *path) {
 // - data
 // Returns:
 // - new OpenGL buffer handle
-GLuint gen_buffer(GLsizei size, GLfloat *data) {
+GLuint gen_buffer(GLsizei size, const GLvoid *data) {
     GLuint buffer;
     glGenBuffers(1, &buffer);
     glBindBuffer(GL_ARRAY_BUFFER, buffer);
@@ -80,6 +80,34 @@ GLuint gen_buffer(GLsizei size, GLfloat *data) {
     return buffer;
 }
 
+// Create an element buffer that draws quads of 4 vertices as 2 triangles each
+// (vertices 0, 1, 2 and 0, 2, 3 of each quad)
+// Arguments:
+// - quads: number of quads
+// Returns:
+// - new OpenGL buffer handle
+GLuint gen_quad_indices(int quads) {
+    GLuint *data = malloc(sizeof(GLuint) * 6 * quads);
+    for (int i = 0; i < quads; i++) {
+        GLuint *d = data + i * 6;
+        GLuint v = i * 4;
+        d[0] = v;
+        d[1] = v + 1;
+        d[2] = v + 2;
+        d[3] = v;
+        d[4] = v + 2;
+        d[5] = v + 3;
+    }
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * 6 * quads, data,
+            GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    free(data);
+    return buffer;
+}
+
 // Delete a single OpenGL data buffer
 // Arguments:
 // - buffer: OpenGL buffer handle of the buffer to delete
@@ -42,13 +42,16 @@ void del_buffer(
 
 GLuint gen_buffer(
         GLsizei size,
-        GLfloat *data);
+        const GLvoid *data);
 
 GLuint gen_faces(
         int components,
         int faces,
         GLfloat *data);
 
+GLuint gen_quad_indices(
+        int quads);
+
 void load_png_texture(
         const char *file_name);
 
@@ -1,22 +1,211 @@
+#include <string.h>
 #include "config.h"
 #include "noise.h"
 #include "world.h"
 
 
+// Terrain and noise values for every (x, z) column of a chunk and its
+// padding (see WORLD_COLUMNS). The decoration noise is only computed for
+// the columns that use it.
+typedef struct {
+    int height[WORLD_COLUMNS];  // terrain height
+    int block[WORLD_COLUMNS];   // terrain block type
+    float grass[WORLD_COLUMNS];
+    float flower[WORLD_COLUMNS];
+    float tree[WORLD_COLUMNS];
+} WorldColumns;
+
+
+// Lattice points per axis that cover a chunk and its padding, with one more
+// on each side so that every column is between two points
+#define LATTICE_SIZE (CHUNK_SIZE / WORLD_LATTICE + 3)
+
+
+// Evaluate noise_simplex2(x * a, z * b) for some of the columns of chunk
+// (p, q) with the batch noise functions. The values are exactly what a
+// direct call gives, so the terrain does not depend on the batching.
+// Arguments:
+// - p: chunk p location
+// - q: chunk q location
+// - context: noise of the world seed
+// - columns: indices of the columns (see WORLD_COLUMNS)
+// - count: number of columns
+// - a, b: scale of x and z
+// - octaves, persistence: noise parameters
+// - out: output, value for each column index (others are left unchanged)
+static void column_noise(
+        int p,
+        int q,
+        const NoiseContext *context,
+        const int *columns,
+        int count,
+        double a,
+        double b,
+        int octaves,
+        float persistence,
+        float *out)
+{
+    float u[WORLD_COLUMNS] = {0};
+    float v[WORLD_COLUMNS] = {0};
+    float values[WORLD_COLUMNS];
+    for (int i = 0; i < count; i++) {
+        int n = columns[i];
+        int x = p * CHUNK_SIZE + n / WORLD_WIDTH - WORLD_PAD;
+        int z = q * CHUNK_SIZE + n % WORLD_WIDTH - WORLD_PAD;
+        u[i] = x * a;
+        v[i] = z * b;
+    }
+    noise_simplex2_batch(
+        context, u, v, values, count, octaves, persistence, 2);
+    for (int i = 0; i < count; i++) {
+        out[columns[i]] = values[i];
+    }
+}
+
+
+// Sample noise_simplex2(x * a, z * a) on the WORLD_LATTICE lattice around
+// chunk (p, q) and interpolate it for each column. The lattice is aligned to
+// world coordinates, so neighboring chunks agree on their shared columns.
+// Arguments:
+// - p: chunk p location
+// - q: chunk q location
+// - context: noise of the world seed
+// - a: scale of x and z
+// - octaves, persistence: noise parameters
+// - out: output, value for each column (see WORLD_COLUMNS)
+static void lattice_noise(
+        int p,
+        int q,
+        const NoiseContext *context,
+        double a,
+        int octaves,
+        float persistence,
+        float *out)
+{
+    float u[LATTICE_SIZE * LATTICE_SIZE];
+    float v[LATTICE_SIZE * LATTICE_SIZE];
+    float values[LATTICE_SIZE * LATTICE_SIZE];
+    int x0 = p * CHUNK_SIZE - WORLD_LATTICE;
+    int z0 = q * CHUNK_SIZE - WORLD_LATTICE;
+    for (int i = 0; i < LATTICE_SIZE; i++) {
+        for (int j = 0; j < LATTICE_SIZE; j++) {
+            int n = i * LATTICE_SIZE + j;
+            u[n] = (x0 + i * WORLD_LATTICE) * a;
+            v[n] = (z0 + j * WORLD_LATTICE) * a;
+        }
+    }
+    noise_simplex2_batch(context, u, v, values,
+        LATTICE_SIZE * LATTICE_SIZE, octaves, persistence, 2);
+    for (int n = 0; n < WORLD_COLUMNS; n++) {
+        int dx = n / WORLD_WIDTH - WORLD_PAD + WORLD_LATTICE;
+        int dz = n % WORLD_WIDTH - WORLD_PAD + WORLD_LATTICE;
+        int i = dx / WORLD_LATTICE;
+        int j = dz / WORLD_LATTICE;
+        float tx = (float)(dx % WORLD_LATTICE) / WORLD_LATTICE;
+        float tz = (float)(dz % WORLD_LATTICE) / WORLD_LATTICE;
+        const float *v0 = values + i * LATTICE_SIZE + j;
+        const float *v1 = v0 + LATTICE_SIZE;
+        float a0 = v0[0] + (v0[1] - v0[0]) * tz;
+        float a1 = v1[0] + (v1[1] - v1[0]) * tz;
+        out[n] = a0 + (a1 - a0) * tx;
+    }
+}
+
+
+// Find the terrain of the columns of chunk (p, q) and the noise of the
+// decorations on it.
+// Arguments:
+// - p: chunk p location
+// - q: chunk q location
+// - context: noise of the world seed
+// - generator: WORLD_GEN_* of the world
+// - columns: output
+static void world_columns(
+        int p,
+        int q,
+        const NoiseContext *context,
+        int generator,
+        WorldColumns *columns)
+{
+    float f[WORLD_COLUMNS];
+    float g[WORLD_COLUMNS];
+    int all[WORLD_COLUMNS];
+    int grass[WORLD_COLUMNS];
+    int trees[WORLD_COLUMNS];
+    int grass_count = 0;
+    int tree_count = 0;
+    for (int n = 0; n < WORLD_COLUMNS; n++) {
+        all[n] = n;
+    }
+    if (generator == WORLD_GEN_LATTICE) {
+        lattice_noise(p, q, context, 0.01, 4, 0.5, f);
+        lattice_noise(p, q, context, -0.01, 2, 0.9, g);
+    }
+    else {
+        column_noise(p, q, context, all, WORLD_COLUMNS,
+            0.01, 0.01, 4, 0.5, f);
+        column_noise(p, q, context, all, WORLD_COLUMNS,
+            -0.01, -0.01, 2, 0.9, g);
+    }
+    for (int n = 0; n < WORLD_COLUMNS; n++) {
+        int dx = n / WORLD_WIDTH - WORLD_PAD;
+        int dz = n % WORLD_WIDTH - WORLD_PAD;
+        int mh = g[n] * 32 + 16;
+        int h = f[n] * mh;
+        // w = block id
+        int w = 1; // grass
+        int t = 12;
+        if (h <= t) {
+            h = t;
+            w = 2; // sand
+        }
+        columns->height[n] = h;
+        columns->block[n] = w;
+        // Decorations are only placed on grass, and trees only where they
+        // fit in the chunk.
+        if (w == 1) {
+            grass[grass_count++] = n;
+            if (dx - 4 >= 0 && dz - 4 >= 0 &&
+                dx + 4 < CHUNK_SIZE && dz + 4 < CHUNK_SIZE)
+            {
+                trees[tree_count++] = n;
+            }
+        }
+    }
+    if (SHOW_PLANTS) {
+        column_noise(p, q, context, grass, grass_count,
+            -0.1, 0.1, 4, 0.8, columns->grass);
+        column_noise(p, q, context, grass, grass_count,
+            0.05, -0.05, 4, 0.8, columns->flower);
+    }
+    if (SHOW_TREES) {
+        column_noise(p, q, context, trees, tree_count,
+            1, 1, 6, 0.5, columns->tree);
+    }
+}
+
+
 // Main terrain generation function
 // Parameters:
 // - p: chunk p location
 // - q: chunk q location
+// - context: noise of the world seed (only read, so it can be shared by
+//   threads)
+// - generator: WORLD_GEN_* of the world
 // - func: function callback to modify blocks in the world (see world.h)
 // - arg: last argument to be used for the function callback
 void create_world(
         int p,
         int q,
+        const NoiseContext *context,
+        int generator,
         world_func func,
         void *arg) 
 {
     // GUESS: the inclusion of the extra pad locations is for tree generation across chunk borders.
-    int pad = 1;
+    int pad = WORLD_PAD;
+    WorldColumns columns;
+    world_columns(p, q, context, generator, &columns);
     // Loop for each (x, z) location in chunk (p, q):
     for (int dx = -pad; dx < CHUNK_SIZE + pad; dx++) {
         for (int dz = -pad; dz < CHUNK_SIZE + pad; dz++) {
@@ -27,17 +216,9 @@ void create_world(
             }
             int x = p * CHUNK_SIZE + dx; // convert p (chunk x) and dx to world x
             int z = q * CHUNK_SIZE + dz; // convert q (chunk z) and dz to world z
-            float f = simplex2(x * 0.01, z * 0.01, 4, 0.5, 2);
-            float g = simplex2(-x * 0.01, -z * 0.01, 2, 0.9, 2);
-            int mh = g * 32 + 16;
-            int h = f * mh;
-            // w = block id
-            int w = 1; // grass
-            int t = 12;
-            if (h <= t) {
-                h = t;
-                w = 2; // sand
-            }
+            int n = (dx + pad) * WORLD_WIDTH + (dz + pad);
+            int h = columns.height[n];
+            int w = columns.block[n];
             // sand and grass terrain
             for (int y = 0; y < h; y++) {
                 func(x, y, z, w * flag, arg);
@@ -46,12 +227,13 @@ void create_world(
             if (w == 1) {
                 if (SHOW_PLANTS) {
                     // grass
-                    if (simplex2(-x * 0.1, z * 0.1, 4, 0.8, 2) > 0.6) {
+                    if (columns.grass[n] > 0.6) {
                         func(x, h, z, 17 * flag, arg);
                     }
                     // flowers
-                    if (simplex2(x * 0.05, -z * 0.05, 4, 0.8, 2) > 0.7) {
-                        int w = 18 + simplex2(x * 0.1, z * 0.1, 4, 0.8, 2) * 7;
+                    if (columns.flower[n] > 0.7) {
+                        int w = 18 + noise_simplex2(
+                            context, x * 0.1, z * 0.1, 4, 0.8, 2) * 7;
                         func(x, h, z, w * flag, arg);
                     }
                 }
@@ -62,7 +244,7 @@ void create_world(
                 {
                     ok = 0;
                 }
-                if (ok && simplex2(x, z, 6, 0.5, 2) > 0.84) {
+                if (ok && columns.tree[n] > 0.84) {
                     for (int y = h + 3; y < h + 8; y++) {
                         for (int ox = -3; ox <= 3; ox++) {
                             for (int oz = -3; oz <= 3; oz++) {
@@ -79,18 +261,100 @@ void create_world(
                     }
                 }
             }
-            // clouds
-            if (SHOW_CLOUDS) {
-                for (int y = 64; y < 72; y++) {
-                    if (simplex3(
-                        x * 0.01, y * 0.1, z * 0.01, 8, 0.5, 2) > 0.75)
-                    {
-                        // Block id 16 is cloud
-                        func(x, y, z, 16 * flag, arg);
-                    }
-                }
-            }
         }
     }
 }
 
+
+// Chunk whose blocks create_world_blocks() is filling in
+typedef struct {
+    int x;                  // world position of the chunk's (0, 0) column
+    int z;
+    signed char *blocks;
+} WorldBlocks;
+
+
+// World function that stores the blocks of a WorldBlocks chunk
+static void world_blocks_func(int x, int y, int z, int w, void *arg) {
+    WorldBlocks *chunk = (WorldBlocks *)arg;
+    int dx = x - chunk->x;
+    int dz = z - chunk->z;
+    if ((unsigned int)dx >= CHUNK_SIZE || (unsigned int)dz >= CHUNK_SIZE ||
+        (unsigned int)y >= WORLD_HEIGHT)
+    {
+        return;
+    }
+    chunk->blocks[WORLD_BLOCK_INDEX(dx, y, dz)] = w;
+}
+
+
+// Generate the blocks of a chunk into an array in one call, for callers that
+// can not cheaply take a callback for every block (such as server.py).
+// The padding around the chunk that create_world() also makes is left out.
+// Parameters:
+// - p: chunk p location
+// - q: chunk q location
+// - context: noise of the world seed
+// - generator: WORLD_GEN_* of the world
+// - blocks: output, WORLD_BLOCKS block ids (see WORLD_BLOCK_INDEX())
+void create_world_blocks(
+        int p,
+        int q,
+        const NoiseContext *context,
+        int generator,
+        signed char *blocks)
+{
+    WorldBlocks chunk;
+    chunk.x = p * CHUNK_SIZE;
+    chunk.z = q * CHUNK_SIZE;
+    chunk.blocks = blocks;
+    memset(blocks, 0, WORLD_BLOCKS);
+    create_world(p, q, context, generator, world_blocks_func, &chunk);
+}
+
+
+// Cloud layer generation function
+// Clouds are not stored in the world as blocks, they are only drawn. Each
+// column has at most one cloud, which is a run of blocks centered in
+// [CLOUD_MIN_Y, CLOUD_MAX_Y) and thicker where the cloud noise is denser.
+// Parameters:
+// - p: chunk p location
+// - q: chunk q location
+// - context: noise of the world seed
+// - bottom: output, lowest cloud y of each column (see WORLD_COLUMNS)
+// - top: output, y just above the highest cloud of each column (equal to
+//   bottom if the column has no cloud)
+void create_clouds(
+        int p,
+        int q,
+        const NoiseContext *context,
+        int *bottom,
+        int *top)
+{
+    float u[WORLD_COLUMNS];
+    float v[WORLD_COLUMNS];
+    float w[WORLD_COLUMNS];
+    float d[WORLD_COLUMNS];
+    int height = CLOUD_MAX_Y - CLOUD_MIN_Y;
+    for (int n = 0; n < WORLD_COLUMNS; n++) {
+        int x = p * CHUNK_SIZE + n / WORLD_WIDTH - WORLD_PAD;
+        int z = q * CHUNK_SIZE + n % WORLD_WIDTH - WORLD_PAD;
+        u[n] = x * 0.01;
+        v[n] = z * 0.01;
+        w[n] = (CLOUD_MIN_Y + height / 2) * 0.1;
+    }
+    if (SHOW_CLOUDS) {
+        noise_simplex3_batch(
+            context, u, w, v, d, WORLD_COLUMNS, 8, 0.5, 2);
+    }
+    for (int n = 0; n < WORLD_COLUMNS; n++) {
+        int h = 0;
+        if (SHOW_CLOUDS && d[n] > 0.66) {
+            h = 1 + (d[n] - 0.66) * 40;
+            h = h < height ? h : height;
+        }
+        bottom[n] = CLOUD_MIN_Y + (height - h) / 2;
+        top[n] = bottom[n] + h;
+    }
+}
+
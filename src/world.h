@@ -2,6 +2,38 @@
 #define _world_h_
 
 
+#include "config.h"
+#include "noise.h"
+
+
+// Columns generated for a chunk: the chunk and 1 block of padding around it.
+// Per-column arrays are indexed with (dx + WORLD_PAD) * WORLD_WIDTH +
+// (dz + WORLD_PAD).
+#define WORLD_PAD 1
+#define WORLD_WIDTH (CHUNK_SIZE + WORLD_PAD * 2)
+#define WORLD_COLUMNS (WORLD_WIDTH * WORLD_WIDTH)
+
+// Terrain generators of a world (see create_world()). A world keeps the
+// generator that it was created with.
+// - WORLD_GEN_CLASSIC: all noise is sampled at every column
+// - WORLD_GEN_LATTICE: the slowly changing height noise is sampled every
+//   WORLD_LATTICE blocks and interpolated
+#define WORLD_GEN_CLASSIC 0
+#define WORLD_GEN_LATTICE 1
+#define WORLD_LATTICE 4
+
+// Blocks of a chunk as filled in by create_world_blocks(): one byte per block
+// of the chunk (without padding), with each column stored from y = 0 up
+#define WORLD_HEIGHT 256
+#define WORLD_BLOCKS (CHUNK_SIZE * CHUNK_SIZE * WORLD_HEIGHT)
+#define WORLD_BLOCK_INDEX(dx, y, dz) \
+    (((dx) * CHUNK_SIZE + (dz)) * WORLD_HEIGHT + (y))
+
+// Clouds are not blocks in the world, see create_clouds()
+#define CLOUD_MIN_Y 64
+#define CLOUD_MAX_Y 72
+
+
 // World function callback signature (used to modify a map's blocks)
 typedef void (*world_func)(int x, int y, int z, int w, void *arg);
 
@@ -9,8 +41,24 @@ typedef void (*world_func)(int x, int y, int z, int w, void *arg);
 void create_world(
         int p,
         int q,
+        const NoiseContext *context,
+        int generator,
         world_func func,
         void *arg);
 
+void create_world_blocks(
+        int p,
+        int q,
+        const NoiseContext *context,
+        int generator,
+        signed char *blocks);
+
+void create_clouds(
+        int p,
+        int q,
+        const NoiseContext *context,
+        int *bottom,
+        int *top);
+
 
 #endif
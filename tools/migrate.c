@@ -0,0 +1,48 @@
+#include "config.h"
+#include "db.h"
+#include <stdio.h>
+#include <string.h>
+
+// Offline world migration.
+// It moves the changes saved in an older world's database, one row per
+// changed block, light or block damage, into chunk storage with one record
+// per chunk (see db.c). Worlds that already use chunk storage are left as
+// they are. The client must not have the world open while it runs.
+//
+// Usage: craft_migrate [-d database]
+// - database: world file (default DB_PATH, like the client's offline world)
+
+
+int main(int argc, char **argv) {
+    char *path = DB_PATH;
+    int ok = 1;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "-d")) {
+            path = argv[i + 1];
+        }
+        else {
+            ok = 0;
+        }
+    }
+    if (!ok || argc % 2 == 0) {
+        fprintf(stderr, "Usage: %s [-d database]\n", argv[0]);
+        return 1;
+    }
+
+    db_enable();
+    if (db_init(path)) {
+        return 1;
+    }
+    int storage;
+    db_load_storage(&storage);
+    int count = db_migrate_chunks();
+    db_close();
+
+    if (storage == DB_STORAGE_CHUNKS) {
+        printf("%s already uses chunk storage\n", path);
+    }
+    else {
+        printf("migrated %d chunks of %s to chunk storage\n", count, path);
+    }
+    return 0;
+}
@@ -0,0 +1,195 @@
+#include "bake.h"
+#include "blockmap.h"
+#include "config.h"
+#include "db.h"
+#include "heightmap.h"
+#include "map.h"
+#include "scheduler.h"
+#include "tinycthread.h"
+#include "world.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Offline world pregeneration.
+// It generates a square or circle of chunks of a world with create_world() on
+// every core, applies the edits saved in the world's database and stores the
+// result in the database as baked chunks (see bake.h). The client then loads
+// those chunks with a single read instead of generating them.
+// Chunks must be baked again after the terrain generator code changes.
+//
+// Usage: craft_pregen [-d database] [-p p] [-q q] [-r radius] [-s shape]
+//                     [-t threads]
+// - database: world file (default DB_PATH, like the client's offline world)
+// - p, q: center chunk (default 0, 0)
+// - radius: chunks at most radius chunks from the center are baked
+// - shape: "square" (default) or "circle"
+// - threads: number of generating threads (default one per core)
+
+
+// Shared state of the generating threads
+typedef struct {
+    int p;                  // center chunk
+    int q;
+    int radius;
+    int circle;             // non-zero to skip chunks outside of the circle
+    int generator;          // terrain generator of the world
+    NoiseContext noise;     // the default world, like the client's
+    int size;               // chunks per side of the square
+    int next;               // next chunk of the square to take
+    int baked;              // number of chunks baked
+    long long bytes;        // size of the baked data
+    mtx_t mtx;              // lock for next, baked, bytes and the database
+} Pregen;
+
+
+static double now(void) {
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    clock_gettime(TIME_UTC, &ts);
+#endif
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void pregen_set_block(int x, int y, int z, int w, void *arg) {
+    block_map_set((BlockMap *)arg, x, y, z, w);
+}
+
+
+// Generate, load and bake chunks until every chunk of the region is done
+static int pregen_worker(void *arg) {
+    Pregen *pregen = (Pregen *)arg;
+    int count = pregen->size * pregen->size;
+    while (1) {
+        mtx_lock(&pregen->mtx);
+        int next = pregen->next++;
+        mtx_unlock(&pregen->mtx);
+        if (next >= count) {
+            break;
+        }
+        int dp = next / pregen->size - pregen->radius;
+        int dq = next % pregen->size - pregen->radius;
+        if (pregen->circle &&
+            dp * dp + dq * dq > pregen->radius * pregen->radius)
+        {
+            continue;
+        }
+        int p = pregen->p + dp;
+        int q = pregen->q + dq;
+        int dx = p * CHUNK_SIZE - 1;
+        int dz = q * CHUNK_SIZE - 1;
+        BlockMap blocks;
+        Map lights;
+        Heightmap heightmap;
+        block_map_alloc(&blocks, dx, 0, dz);
+        map_alloc(&lights, dx, 0, dz, 0xf);
+        create_world(p, q, &pregen->noise, pregen->generator,
+            pregen_set_block, &blocks);
+        db_load_chunk(&blocks, &lights, NULL, p, q);
+        heightmap_build(&heightmap, &blocks, p, q);
+        unsigned char *data;
+        int size = bake_chunk(
+            &blocks, &lights, &heightmap, pregen->generator, &data);
+        block_map_free(&blocks);
+        map_free(&lights);
+        mtx_lock(&pregen->mtx);
+        db_save_bake(p, q, data, size);
+        pregen->baked++;
+        pregen->bytes += size;
+        if (pregen->baked % 256 == 0) {
+            db_commit();
+        }
+        mtx_unlock(&pregen->mtx);
+        free(data);
+    }
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+    char *path = DB_PATH;
+    int p = 0;
+    int q = 0;
+    int radius = 8;
+    int circle = 0;
+    int threads = get_cpu_count();
+    int ok = 1;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        char *value = argv[i + 1];
+        if (!strcmp(argv[i], "-d")) {
+            path = value;
+        }
+        else if (!strcmp(argv[i], "-p")) {
+            p = atoi(value);
+        }
+        else if (!strcmp(argv[i], "-q")) {
+            q = atoi(value);
+        }
+        else if (!strcmp(argv[i], "-r")) {
+            radius = atoi(value);
+        }
+        else if (!strcmp(argv[i], "-s")) {
+            circle = !strcmp(value, "circle");
+            ok = ok && (circle || !strcmp(value, "square"));
+        }
+        else if (!strcmp(argv[i], "-t")) {
+            threads = atoi(value);
+        }
+        else {
+            ok = 0;
+        }
+    }
+    if (!ok || argc % 2 == 0 || radius < 0 || threads < 1) {
+        fprintf(stderr,
+            "Usage: %s [-d database] [-p p] [-q q] [-r radius] "
+            "[-s square|circle] [-t threads]\n",
+            argv[0]);
+        return 1;
+    }
+
+    db_enable();
+    if (db_init(path)) {
+        return 1;
+    }
+
+    // same as load_world_generator() for an offline world
+    Pregen pregen;
+    if (!db_load_generator(&pregen.generator)) {
+        pregen.generator =
+            db_is_new_world() ? WORLD_GENERATOR : WORLD_GEN_CLASSIC;
+        db_save_generator(pregen.generator);
+    }
+    pregen.p = p;
+    pregen.q = q;
+    pregen.radius = radius;
+    pregen.circle = circle;
+    pregen.size = radius * 2 + 1;
+    pregen.next = 0;
+    pregen.baked = 0;
+    pregen.bytes = 0;
+    noise_init(&pregen.noise);
+    mtx_init(&pregen.mtx, mtx_plain);
+
+    double start = now();
+    thrd_t *thrds = malloc(sizeof(thrd_t) * threads);
+    for (int i = 0; i < threads; i++) {
+        thrd_create(thrds + i, pregen_worker, &pregen);
+    }
+    for (int i = 0; i < threads; i++) {
+        thrd_join(thrds[i], NULL);
+    }
+    double elapsed = now() - start;
+    free(thrds);
+    mtx_destroy(&pregen.mtx);
+    db_close();
+
+    printf("baked %d chunks around (%d, %d) in %.1f ms with %d threads\n",
+        pregen.baked, p, q, elapsed * 1000, threads);
+    printf("  %.1f chunks/s, %.1f KiB per chunk\n",
+        pregen.baked / elapsed,
+        pregen.baked ? pregen.bytes / 1024.0 / pregen.baked : 0.0);
+    return 0;
+}
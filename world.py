@@ -1,23 +1,62 @@
-# gcc -std=c99 -O3 -shared -o world \
+# gcc -std=c99 -O3 -fPIC -shared -o world \
 #   -I src -I deps/noise deps/noise/noise.c src/world.c
 
-from ctypes import CDLL, CFUNCTYPE, c_float, c_int, c_void_p
+from array import array
+from ctypes import (
+    CDLL, CFUNCTYPE, POINTER, Structure, byref,
+    c_byte, c_float, c_int, c_ubyte, c_uint, c_void_p)
 from collections import OrderedDict
 
 dll = CDLL('./world')
 
 WORLD_FUNC = CFUNCTYPE(None, c_int, c_int, c_int, c_int, c_void_p)
 
+class NoiseContext(Structure):
+    _fields_ = [('perm', c_ubyte * 512)]
+
+dll.noise_init.argtypes = [POINTER(NoiseContext)]
+dll.noise_seed.argtypes = [POINTER(NoiseContext), c_uint]
+def dll_noise_context(seed=None):
+    context = NoiseContext()
+    if seed is None:
+        dll.noise_init(byref(context))
+    else:
+        dll.noise_seed(byref(context), seed)
+    return context
+
 def dll_seed(x):
     dll.seed(x)
 
-def dll_create_world(p, q):
+WORLD_GEN_CLASSIC = 0
+WORLD_GEN_LATTICE = 1
+
+# chunk blocks as filled in by create_world_blocks (see world.h)
+CHUNK_SIZE = 32
+WORLD_HEIGHT = 256
+WORLD_BLOCKS = CHUNK_SIZE * CHUNK_SIZE * WORLD_HEIGHT
+
+def world_block_index(dx, y, dz):
+    return (dx * CHUNK_SIZE + dz) * WORLD_HEIGHT + y
+
+dll.create_world.argtypes = [
+    c_int, c_int, POINTER(NoiseContext), c_int, WORLD_FUNC, c_void_p]
+def dll_create_world(p, q, context, generator=WORLD_GEN_CLASSIC):
     result = {}
     def world_func(x, y, z, w, arg):
         result[(x, y, z)] = w
-    dll.create_world(p, q, WORLD_FUNC(world_func), None)
+    dll.create_world(
+        p, q, byref(context), generator, WORLD_FUNC(world_func), None)
     return result
 
+dll.create_world_blocks.argtypes = [
+    c_int, c_int, POINTER(NoiseContext), c_int, POINTER(c_byte)]
+def dll_create_world_blocks(p, q, context, generator=WORLD_GEN_CLASSIC):
+    blocks = array('b', bytes(WORLD_BLOCKS))
+    buffer = (c_byte * WORLD_BLOCKS).from_buffer(blocks)
+    dll.create_world_blocks(p, q, byref(context), generator, buffer)
+    del buffer
+    return blocks
+
 dll.simplex2.restype = c_float
 dll.simplex2.argtypes = [c_float, c_float, c_int, c_float, c_float]
 def dll_simplex2(x, y, octaves=1, persistence=0.5, lacunarity=2.0):
@@ -29,20 +68,32 @@ def dll_simplex3(x, y, z, octaves=1, persistence=0.5, lacunarity=2.0):
     return dll.simplex3(x, y, z, octaves, persistence, lacunarity)
 
 class World(object):
-    def __init__(self, seed=None, cache_size=64):
+    # cache_bytes: memory budget of the generated chunks that are kept
+    def __init__(self, seed=None, cache_bytes=64 << 20,
+            generator=WORLD_GEN_CLASSIC):
         self.seed = seed
+        self.generator = generator
+        self.noise = dll_noise_context(seed)
         self.cache = OrderedDict()
-        self.cache_size = cache_size
+        self.cache_bytes = cache_bytes
+        self.cache_used = 0
     def create_chunk(self, p, q):
-        if self.seed is not None:
-            dll_seed(self.seed)
-        return dll_create_world(p, q)
+        return dll_create_world_blocks(p, q, self.noise, self.generator)
     def get_chunk(self, p, q):
         try:
             chunk = self.cache.pop((p, q))
         except KeyError:
             chunk = self.create_chunk(p, q)
+            self.cache_used += len(chunk)
         self.cache[(p, q)] = chunk
-        if len(self.cache) > self.cache_size:
-            self.cache.popitem(False)
+        while self.cache_used > self.cache_bytes and len(self.cache) > 1:
+            _, old = self.cache.popitem(False)
+            self.cache_used -= len(old)
         return chunk
+    def get_block(self, x, y, z):
+        if y < 0 or y >= WORLD_HEIGHT:
+            return 0
+        p, q = x // CHUNK_SIZE, z // CHUNK_SIZE
+        chunk = self.get_chunk(p, q)
+        return chunk[world_block_index(
+            x - p * CHUNK_SIZE, y, z - q * CHUNK_SIZE)]